@@ -0,0 +1,281 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Przypisanie watkow do procesorow
+ * Pinning workers to CPUs
+ *
+ * policies:
+ *	compact	- workers fill one socket after another
+ *	scatter	- workers are dealt round-robin to the sockets
+ *	list	- explicit CPUs, e.g. 0,2,8-15 (worker i gets the i-th one)
+ *
+ * The topology comes from /sys/devices/system/cpu; only the CPUs we are
+ * allowed to run on (sched_getaffinity) are used, a list naming another
+ * one is refused.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <pthread.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "affinity.h"
+
+typedef struct {
+    int cpu;
+    int socket;
+    int core;
+} cpuinfo;
+
+static cpuinfo* map = NULL;	/* CPU of every worker (modulo nmap) */
+static int nmap = 0;
+static int failed = 0;		/* whether a failed pinning has been reported */
+static int registered = 0;	/* whether affinity_fini runs at exit */
+
+///////////////////////////////////////
+
+static int
+read_id(int cpu, const char* what)
+{
+    char path[128];
+    FILE* fp;
+    int v = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+    fp = fopen(path, "r");
+    if ( fp == NULL )
+        return 0;
+    if ( fscanf(fp, "%d", &v) != 1 )
+        v = 0;
+    fclose(fp);
+
+    return v;
+}
+
+///////////////////////////////////////
+
+static int
+by_socket(const void* a, const void* b)
+{
+    const cpuinfo* x = (const cpuinfo*)a;
+    const cpuinfo* y = (const cpuinfo*)b;
+
+    if ( x->socket != y->socket )
+        return x->socket - y->socket;
+    if ( x->core != y->core )
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+///////////////////////////////////////
+
+static int
+parse_list(const char* list, cpuinfo* out, int max)
+    /* 0,2,8-15 */
+{
+    const char* p = list;
+    char* end;
+    int lo, hi, n = 0;
+
+    while ( *p ) {
+        lo = hi = strtol(p, &end, 10);
+        if ( end == p || lo < 0 )
+            return -1;
+        p = end;
+        if ( *p == '-' ) {
+            hi = strtol(++p, &end, 10);
+            if ( end == p || hi < lo )
+                return -1;
+            p = end;
+        }
+        for ( ; lo <= hi && n < max; lo++, n++ ) {
+            out[n].cpu = lo;
+            out[n].socket = read_id(lo, "physical_package_id");
+            out[n].core = read_id(lo, "core_id");
+        }
+        if ( *p == ',' )
+            p++;
+        else if ( *p )
+            return -1;
+    }
+
+    return n;
+}
+
+///////////////////////////////////////
+int
+affinity_init(const char* policy, int num_proc)
+{
+    cpu_set_t set;
+    cpuinfo* cpus;
+    int i, n, s, k, nsockets;
+
+    if ( sched_getaffinity(0, sizeof(set), &set) ) {
+        perror("[Affinity]->sched_getaffinity");
+        return 1;
+    }
+
+    if ( ! registered ) {
+        atexit(affinity_fini);
+        registered = 1;
+    }
+    free(map);
+    cpus = (cpuinfo*)malloc(CPU_SETSIZE * sizeof(cpuinfo));
+    map = (cpuinfo*)malloc(CPU_SETSIZE * sizeof(cpuinfo));
+    if ( cpus == NULL || map == NULL ) {
+        printf("Error: Not enough memory for the CPU map\n");
+        free(cpus);
+        affinity_fini();
+        return 1;
+    }
+    n = 0;
+    for ( i = 0; i < CPU_SETSIZE; i++ )
+        if ( CPU_ISSET(i, &set) ) {
+            cpus[n].cpu = i;
+            cpus[n].socket = read_id(i, "physical_package_id");
+            cpus[n].core = read_id(i, "core_id");
+            n++;
+        }
+    qsort(cpus, n, sizeof(cpuinfo), by_socket);
+
+    if ( ! strcmp(policy, "compact") ) {
+        memcpy(map, cpus, n * sizeof(cpuinfo));
+        nmap = n;
+    } else if ( ! strcmp(policy, "scatter") ) {
+        /* k-th CPU of every socket in turn */
+        nsockets = cpus[n-1].socket + 1;
+        nmap = 0;
+        for ( k = 0; nmap < n; k++ )
+            for ( s = 0; s < nsockets; s++ ) {
+                int seen = 0;
+
+                for ( i = 0; i < n; i++ )
+                    if ( cpus[i].socket == s && seen++ == k ) {
+                        map[nmap++] = cpus[i];
+                        break;
+                    }
+            }
+    } else {
+        nmap = parse_list(policy, map, CPU_SETSIZE);
+        if ( nmap <= 0 ) {
+            printf("Error: Wrong affinity policy: %s (compact, scatter or a CPU list)\n", policy);
+            free(cpus);
+            affinity_fini();
+            return 1;
+        }
+        /* pinning to a CPU outside our cpuset would fail in every worker */
+        for ( i = 0; i < nmap; i++ )
+            if ( map[i].cpu >= CPU_SETSIZE || ! CPU_ISSET(map[i].cpu, &set) ) {
+                printf("Error: CPU %d of the affinity list is not one this process may run on\n", map[i].cpu);
+                free(cpus);
+                affinity_fini();
+                return 1;
+            }
+    }
+    free(cpus);
+
+    if ( num_proc > nmap )
+        printf("[Affinity]->Warning: %d workers share %d CPUs\n", num_proc, nmap);
+
+    return 0;
+}
+
+///////////////////////////////////////
+void
+affinity_fini()
+{
+    free(map);
+    map = NULL;
+    nmap = 0;
+}
+
+///////////////////////////////////////
+int
+affinity_enabled()
+{
+    return nmap > 0;
+}
+
+///////////////////////////////////////
+int
+affinity_pin(int worker)
+    /* pins the calling thread as the given worker */
+{
+    cpu_set_t set;
+    int rc;
+
+    if ( nmap == 0 || worker < 0 )
+        return 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(map[worker % nmap].cpu, &set);
+
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    /* every worker would fail the same way, one message is enough */
+    if ( rc && ! __atomic_exchange_n(&failed, 1, __ATOMIC_RELAXED) )
+        printf("[Affinity]->Cannot pin worker %d to CPU %d: %s\n", worker, map[worker % nmap].cpu, strerror(rc));
+
+    return rc;
+}
+
+///////////////////////////////////////
+int
+affinity_socket(int worker)
+{
+    if ( nmap == 0 )
+        return 0;
+
+    return map[worker % nmap].socket;
+}
+
+///////////////////////////////////////
+int*
+affinity_scan_order(int num_proc)
+    /*
+     * order[w * num_proc + k] is the k-th worker the manager asks for work
+     * for the free worker w; order[w * num_proc] is w itself, then come
+     * the workers of w's socket and then the others, each group in the
+     * manager's usual round-robin order
+     */
+{
+    int* order = (int*)malloc((size_t)num_proc * num_proc * sizeof(int));
+    int w, k, i, j, local;
+
+    for ( w = 0; w < num_proc; w++ ) {
+        order[w * num_proc] = w;
+        j = 1;
+        for ( local = 1; local >= 0; local-- )
+            for ( k = 1; k < num_proc; k++ ) {
+                i = (w + k) % num_proc;
+                if ( (affinity_socket(i) == affinity_socket(w)) == local )
+                    order[w * num_proc + j++] = i;
+            }
+    }
+
+    return order;
+}
+
+///////////////////////////////////////
+void
+affinity_report(int num_proc)
+{
+    int w;
+
+    if ( nmap == 0 )
+        return;
+
+    printf("[Affinity]->Worker -> CPU (socket):");
+    for ( w = 0; w < num_proc; w++ )
+        printf(" %d->%d(%d)", w, map[w % nmap].cpu, map[w % nmap].socket);
+    printf("\n");
+}
+
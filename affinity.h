@@ -0,0 +1,19 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef AFFINITYH
+#define AFFINITYH
+
+extern int affinity_init(const char* policy, int num_proc);
+extern void affinity_fini();
+extern int affinity_pin(int worker);
+extern int affinity_socket(int worker);
+extern int affinity_enabled();
+extern int* affinity_scan_order(int num_proc);
+extern void affinity_report(int num_proc);
+
+#endif
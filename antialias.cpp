@@ -0,0 +1,180 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Wygladzanie krawedzi
+ * Edge-adaptive anti-aliasing
+ *
+ * After the picture has been rendered (by any backend, one sample in
+ * the middle of every pixel) the pixels whose value differs from one of
+ * their neighbours get n more samples, jittered inside strata of the
+ * pixel; the strata are n cells spread evenly over a grid of at least n
+ * cells, so the samples cover the whole pixel also when n is not a square.
+ * Colouring then averages the colours of all the samples of such
+ * a pixel in the output; the other pixels keep their single sample.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "antialias.h"
+#include "formula.h"
+
+using namespace std;
+
+///////////////////////////////////////
+
+static inline double
+jitter(uint32_t* s)
+    /* xorshift, the same pixel is always sampled the same way */
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return (*s & 0xffffff) / (double)0x1000000;
+}
+
+///////////////////////////////////////
+
+static int
+is_edge(char** tab, int res, int x, int y)
+{
+    char v = tab[y][x];
+
+    return ( x > 0 && tab[y][x-1] != v ) || ( x < res-1 && tab[y][x+1] != v )
+        || ( y > 0 && tab[y-1][x] != v ) || ( y < res-1 && tab[y+1][x] != v );
+}
+
+///////////////////////////////////////
+aa_data*
+aa_render(const fdata* fd, int n)
+{
+    aa_data* aa;
+    int y, res = fd->resolution;
+    int grid = (int)ceil(sqrt((double)n));
+    uint64_t* first;	/* index of the first edge pixel of every row */
+    long i;
+
+#ifdef DEBUG
+    printf("[Main]->aa_render: %d\n", n);
+#endif
+
+    aa = (aa_data*)calloc(1, sizeof(aa_data));
+    first = (uint64_t*)malloc((res + 1) * sizeof(uint64_t));
+    if ( aa == NULL || first == NULL ) {
+        printf("Error: Not enough memory for anti-aliasing\n");
+        free(aa);
+        free(first);
+        return NULL;
+    }
+    aa->n = n;
+
+    /* rows are scanned in parallel twice: counting the edge pixels, then listing them in order */
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, first, res) schedule(static)
+    for ( y = 0; y < res; y++ ) {
+        uint64_t c = 0;
+        int x;
+
+        for ( x = 0; x < res; x++ )
+            c += is_edge(fd->tab, res, x, y);
+        first[y + 1] = c;
+    }
+    for ( first[0] = 0, y = 0; y < res; y++ )
+        first[y + 1] += first[y];
+    aa->count = first[res];
+
+    aa->idx = (uint64_t*)malloc((aa->count ? aa->count : 1) * sizeof(uint64_t));
+    aa->val = (int*)malloc((aa->count ? aa->count : 1) * n * sizeof(int));
+    if ( aa->idx == NULL || aa->val == NULL ) {
+        printf("Error: Not enough memory for the samples of %llu edge pixels\n", (unsigned long long)aa->count);
+        free(first);
+        aa_free(aa);
+        return NULL;
+    }
+
+#pragma omp parallel for default(none) shared(fd, aa, first, res) schedule(static)
+    for ( y = 0; y < res; y++ ) {
+        uint64_t k = first[y];
+        int x;
+
+        for ( x = 0; x < res; x++ )
+            if ( is_edge(fd->tab, res, x, y) )
+                aa->idx[k++] = (uint64_t)y * res + x;
+    }
+    free(first);
+
+#pragma omp parallel for default(none) shared(fd, aa, n, grid, res) schedule(dynamic, 64)
+    for ( i = 0; i < (long)aa->count; i++ ) {
+        int px = aa->idx[i] % res, py = aa->idx[i] / res;
+        uint32_t seed = (uint32_t)aa->idx[i] * 2654435761u + 1;
+        int s;
+
+        for ( s = 0; s < n; s++ ) {
+            /* one sample in a random place of every stratum of the pixel, the strata spread over the grid */
+            int cell = (int)((long)s * grid * grid / n);
+            double sx = ( cell % grid + jitter(&seed) ) / grid;
+            double sy = ( cell / grid + jitter(&seed) ) / grid;
+            complex<double> c(fd->xmin+(fd->xo+px+sx)*fd->xdiff, fd->ymin+(fd->yo+py+sy)*fd->ydiff);
+
+            aa->val[i * n + s] = fractal_point(c, fd);
+        }
+    }
+
+    /* the cost compared with sampling every pixel n+1 times */
+    printf("[Antialias]->Edge pixels: %llu (%.1f%%), samples: %llu (%.1f%% of uniform %dx)\n",
+            (unsigned long long)aa->count, 100.0 * aa->count / ((double)res * res),
+            (unsigned long long)aa->count * n,
+            100.0 * ((double)res * res + (double)aa->count * n) / ((double)res * res * (n + 1)), n + 1);
+
+    return aa;
+}
+
+///////////////////////////////////////
+void
+aa_colour(const fdata* fd, const aa_data* aa, const rgb_t* lut, unsigned char* rgb)
+    /* colours of all the samples of an edge pixel are accumulated and averaged */
+{
+    int res = fd->resolution, n = aa->n;
+    long i;
+
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, aa, lut, rgb, res, n) schedule(static)
+    for ( i = 0; i < (long)aa->count; i++ ) {
+        int px = aa->idx[i] % res, py = aa->idx[i] / res;
+        const unsigned char* c = lut[colour_at(fd, px, py)];
+        unsigned char* out = rgb + ((size_t)(res - 1 - py) * res + px) * 3;
+        float a[3];
+        int s;
+
+        a[0] = c[0], a[1] = c[1], a[2] = c[2];
+        for ( s = 0; s < n; s++ ) {
+            c = lut[colour_index(fd, aa->val[i * n + s])];
+            a[0] += c[0], a[1] += c[1], a[2] += c[2];
+        }
+        out[0] = (unsigned char)(a[0] / (n + 1) + 0.5f);
+        out[1] = (unsigned char)(a[1] / (n + 1) + 0.5f);
+        out[2] = (unsigned char)(a[2] / (n + 1) + 0.5f);
+    }
+}
+
+///////////////////////////////////////
+void
+aa_free(aa_data* aa)
+{
+    if ( aa == NULL )
+        return;
+    free(aa->idx);
+    free(aa->val);
+    free(aa);
+}
+
@@ -0,0 +1,30 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef ANTIALIASH
+#define ANTIALIASH
+
+#include <stdint.h>
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+#define AA_MAX	64	/* maximal number of sub-samples of a pixel */
+
+/* sub-samples of the pixels lying on edges */
+typedef struct {
+    int n;			/* sub-samples per pixel */
+    uint64_t count;		/* number of edge pixels */
+    uint64_t* idx;		/* y * resolution + x of every edge pixel */
+    int* val;		/* n escape times of every edge pixel */
+} aa_data;
+
+extern aa_data* aa_render(const fdata*, int n);
+extern void aa_colour(const fdata*, const aa_data*, const rgb_t* lut, unsigned char* rgb);
+extern void aa_free(aa_data*);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Dobor konfiguracji
+ * Autotuning of the backend, threads, MagicBox depth and chunk size
+ *
+ * Every candidate configuration renders the picture's viewport twice at a
+ * low resolution, AT_PROBE and AT_PROBE/2 pixels. The two times give the
+ * fixed cost (starting threads, the managers' waiting) and the cost of a
+ * pixel, and so the time of the real render. The MagicBox depth is tuned
+ * as the number of times the picture is divided (-s), which does not
+ * depend on the resolution, and turned into sbs with box_size().
+ *
+ * A candidate whose smaller probe is already slower than the best estimate
+ * so far is dropped without the rest of its runs.
+ *
+ * Threads go up to -n when it is given, otherwise up to the CPUs online.
+ *
+ * The winner is kept in a profile file, a line per machine, limit of the
+ * threads and class of pictures (formula, order of magnitude of the
+ * resolution and of maxiter), and reused by later runs; removing the line
+ * makes them tune again.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "autotune.h"
+#include "backend.h"
+
+#define AT_PROBE	256	/* side of the larger probe (in pixels) */
+#define AT_RUNS		2	/* runs of every probe, the fastest one counts */
+#define AT_MAX		256	/* most candidates */
+#define AT_LINE		512
+
+typedef struct {
+    int backend, threads;
+    int sbox;		/* MagicBox divisions (-s), 0 if not MagicBox */
+    int chunk;		/* rows taken at once (-c) */
+    double est;		/* estimated seconds of the real render */
+} config;
+
+///////////////////////////////////////
+
+static double
+probe(const fdata* fd, const config* c, int n, double bound)
+    /* seconds of rendering the viewport at resolution n with configuration c, no more runs once over bound */
+{
+    const backend* b = backend_get(c->backend);
+    fdata sub = *fd;
+    double t, best = -1;
+    char* block;
+    int i, r;
+
+    sub.resolution = n;
+    sub.xdiff = (sub.xmax - sub.xmin) / n;
+    sub.ydiff = (sub.ymax - sub.ymin) / n;
+    sub.backend = c->backend;
+    sub.use_mb = b->use_mb;
+    sub.use_omp = b->use_omp;
+    sub.num_proc = c->threads;
+    sub.sbs = ( c->sbox && box_size(n, c->sbox) > 0 ) ? box_size(n, c->sbox) : 1;
+    sub.omp_chunk = c->chunk;
+    sub.groups = 0;
+    sub.rowdone = NULL;
+    sub.counts = NULL;
+    sub.cancel = NULL;
+
+    sub.tab = (char**)malloc(n * sizeof(char*));
+    block = (char*)malloc((size_t)n * n);
+    if ( sub.tab == NULL || block == NULL ) {
+        free(sub.tab);
+        free(block);
+        return -1;
+    }
+    for ( i = 0; i < n; i++ )
+        sub.tab[i] = block + (size_t)i * n;
+
+    for ( r = 0; r < AT_RUNS; r++ ) {
+        sub.touch = 1;
+        t = - omp_get_wtime();
+        b->render(&sub);
+        t += omp_get_wtime();
+        if ( best < 0 || t < best )
+            best = t;
+        if ( bound >= 0 && best > bound )
+            break;
+    }
+
+    free(sub.tab);
+    free(block);
+
+    return best;
+}
+
+///////////////////////////////////////
+
+static double
+estimate(const fdata* fd, const config* c, double bound)
+    /* time of the real render: fixed cost + cost of a pixel, both from two probes */
+{
+    int n = fd->resolution;
+    double t1, t2, a, b, p1, p2;
+
+    if ( n <= AT_PROBE )
+        return probe(fd, c, n, bound);
+
+    /* the estimate is never below the smaller probe */
+    t1 = probe(fd, c, AT_PROBE / 2, bound);
+    if ( t1 < 0 || (bound >= 0 && t1 > bound) )
+        return t1;
+    t2 = probe(fd, c, AT_PROBE, -1);
+    if ( t2 < 0 )
+        return -1;
+
+    p1 = (double)(AT_PROBE / 2) * (AT_PROBE / 2);
+    p2 = (double)AT_PROBE * AT_PROBE;
+    b = ( t2 > t1 ) ? (t2 - t1) / (p2 - p1) : t2 / p2;
+    a = ( t2 > b * p2 ) ? t2 - b * p2 : 0;
+
+    return a + b * n * n;
+}
+
+///////////////////////////////////////
+
+static int
+candidates(const fdata* fd, int most, config* c)
+    /* every configuration worth a probe, up to most threads; returns their number */
+{
+    static const int sboxes[] = { 3, 4, 5 };
+    static const int chunks[] = { 1, 4, 16 };
+    int threads[32], nt = 0, t, i, k, s, h, nc = 0;
+
+    for ( t = 2; t < most && nt < 31; t *= 2 )
+        threads[nt++] = t;
+    threads[nt++] = most;
+
+    for ( i = 0; i < backend_count(); i++ ) {
+        const backend* b = backend_get(i);
+        int chunked = ! b->use_mb && (b->use_omp || ! strcmp(b->name, "threads"));
+
+        for ( k = 0; k < nt; k++ ) {
+            t = threads[k];
+            if ( ! strcmp(b->name, "sq") && k > 0 )
+                break;
+
+            for ( s = 0; s < (b->use_mb ? 3 : 1); s++ )
+                for ( h = 0; h < (chunked ? 3 : 1) && nc < AT_MAX; h++ ) {
+                    c[nc].backend = i;
+                    c[nc].threads = ( ! strcmp(b->name, "sq") ) ? 1 : t;
+                    c[nc].sbox = b->use_mb ? sboxes[s] : 0;
+                    c[nc].chunk = chunked ? chunks[h] : fd->omp_chunk;
+                    nc++;
+                }
+        }
+    }
+
+    return nc;
+}
+
+///////////////////////////////////////
+
+static int
+ilog2(int v)
+{
+    int l = 0;
+
+    while ( v > 1 ) {
+        v /= 2;
+        l++;
+    }
+    return l;
+}
+
+///////////////////////////////////////
+
+static void
+profile_key(const fdata* fd, int most, char* key, size_t len)
+    /* machine, the threads it may use and class of the picture */
+{
+    char host[64];
+
+    if ( gethostname(host, sizeof(host)) )
+        strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+
+    snprintf(key, len, "%s %d f%d.%d r%d i%d", host, most,
+            fd->formula, fd->power, ilog2(fd->resolution), ilog2(fd->maxiter));
+}
+
+///////////////////////////////////////
+
+static int
+profile_load(const char* file, const char* key, config* c)
+    /* the configuration saved for key, 1 if there is none */
+{
+    char line[AT_LINE], name[64];
+    size_t kl = strlen(key);
+    FILE* fp = fopen(file, "r");
+    int found = 0;
+
+    if ( fp == NULL )
+        return 1;
+    while ( ! found && fgets(line, sizeof(line), fp) != NULL )
+        if ( ! strncmp(line, key, kl) && line[kl] == ' '
+                && sscanf(line + kl, "%63s %d %d %d", name, &c->threads, &c->sbox, &c->chunk) == 4
+                && (c->backend = backend_find(name)) >= 0 && c->threads > 0 && c->chunk > 0 )
+            found = 1;
+    fclose(fp);
+
+    return ! found;
+}
+
+///////////////////////////////////////
+
+static int
+profile_save(const char* file, const char* key, const config* c)
+    /* replaces the line of key, the lines of other keys stay */
+{
+    char line[AT_LINE], tmp[AT_LINE];
+    size_t kl = strlen(key);
+    FILE *in, *out;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    if ( (out = fopen(tmp, "w")) == NULL ) {
+        perror("[Autotune]->profile_save");
+        return 1;
+    }
+    if ( (in = fopen(file, "r")) != NULL ) {
+        while ( fgets(line, sizeof(line), in) != NULL )
+            if ( strncmp(line, key, kl) || line[kl] != ' ' )
+                fputs(line, out);
+        fclose(in);
+    }
+    fprintf(out, "%s %s %d %d %d\n", key, backend_get(c->backend)->name, c->threads, c->sbox, c->chunk);
+    fclose(out);
+
+    if ( rename(tmp, file) ) {
+        perror("[Autotune]->profile_save");
+        return 1;
+    }
+    return 0;
+}
+
+///////////////////////////////////////
+
+static void
+apply(fdata* fd, const config* c)
+{
+    const backend* b = backend_get(c->backend);
+
+    fd->backend = c->backend;
+    fd->use_mb = b->use_mb;
+    fd->use_omp = b->use_omp;
+    fd->num_proc = c->threads;
+    fd->omp_chunk = c->chunk;
+    if ( c->sbox )
+        fd->sbs = ( box_size(fd->resolution, c->sbox) > 0 ) ? box_size(fd->resolution, c->sbox) : 1;
+}
+
+///////////////////////////////////////
+int
+autotune(fdata* fd, const char* profile, int most)
+    /* most - threads given by -n, which are not exceeded; 0 - as many as CPUs online */
+{
+    config* c;
+    char key[AT_LINE];
+    int i, nc, best = -1;
+    double t;
+
+#ifdef DEBUG
+    printf("[Autotune]->autotune: %s\n", profile);
+#endif
+
+    if ( most < 1 )
+        most = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ( most < 1 )
+        most = 1;
+    profile_key(fd, most, key, sizeof(key));
+    c = (config*)malloc(AT_MAX * sizeof(config));
+    if ( c == NULL ) {
+        printf("Error: Not enough memory for autotuning\n");
+        return 1;
+    }
+
+    if ( ! profile_load(profile, key, &c[0]) ) {
+        printf("[Autotune]->Profile of %s: %s\n", key, backend_get(c[0].backend)->name);
+        apply(fd, &c[0]);
+        free(c);
+        return 0;
+    }
+
+    nc = candidates(fd, most, c);
+
+    t = - omp_get_wtime();
+    for ( i = 0; i < nc; i++ ) {
+        c[i].est = estimate(fd, &c[i], best < 0 ? -1 : c[best].est);
+        printf("[Autotune]->%-13s threads %3d  -s %d  -c %2d: %9.4f s%s\n", backend_get(c[i].backend)->name,
+                c[i].threads, c[i].sbox, c[i].chunk, c[i].est,
+                ( best >= 0 && c[i].est > c[best].est ) ? " (dropped)" : "");
+        if ( c[i].est >= 0 && (best < 0 || c[i].est < c[best].est) )
+            best = i;
+    }
+    t += omp_get_wtime();
+
+    if ( best < 0 ) {
+        printf("Error: No configuration could be probed\n");
+        free(c);
+        return 1;
+    }
+    printf("[Autotune]->%d configurations probed in %.3f s, the fastest: %s, %d threads, -s %d, -c %d\n",
+            nc, t, backend_get(c[best].backend)->name, c[best].threads, c[best].sbox, c[best].chunk);
+
+    apply(fd, &c[best]);
+    profile_save(profile, key, &c[best]);
+    free(c);
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef AUTOTUNEH
+#define AUTOTUNEH
+
+#include "mandelbrot_set.h"
+
+extern int autotune(fdata*, const char* profile, int most);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Rejestr silnikow
+ * Registry of the backends
+ *
+ * Every engine is chosen by its name (-B); without a name the flags
+ * -n, -o and -m choose as they always have. All of them share the
+ * kernel of formula.h, so any two can be timed against each other on
+ * the same picture.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "mandelbrot_set.h"
+#include "backend.h"
+#include "manager.h"
+#include "mandelbrot_set_sq.h"
+#include "mandelbrot_set_omp.h"
+#include "mandelbrot_set_thr.h"
+
+static const backend registry[] = {
+    { "sq",		"sequential, row by row",				0, 0, gen_fractal_sq },
+    { "pthreads",	"POSIX Threads, rows handed out by the manager",	0, 0, gen_fractal_pthreads },
+    { "magicbox",	"POSIX Threads, MagicBox boxes handed out by the manager", 1, 0, gen_fractal_pthreads },
+    { "omp",		"OpenMP dynamic schedule of rows (-c, -l)",		0, 1, gen_fractal_omp },
+    { "omp-magicbox",	"OpenMP tasks of MagicBox",				1, 1, gen_fractal_omp_mb },
+    { "threads",	"C++11 threads taking -c rows from an atomic counter",	0, 0, gen_fractal_thr },
+};
+
+#define NBACKENDS	(int)(sizeof(registry) / sizeof(registry[0]))
+
+///////////////////////////////////////
+int
+backend_find(const char* name)
+    /* index of the backend, -1 if there is no such one */
+{
+    int i;
+
+    for ( i = 0; i < NBACKENDS; i++ )
+        if ( ! strcmp(registry[i].name, name) )
+            return i;
+
+    return -1;
+}
+
+///////////////////////////////////////
+int
+backend_default(const fdata* fd)
+    /* the backend chosen by the flags */
+{
+    if ( fd->num_proc == 1 )
+        return backend_find("sq");
+    if ( fd->use_omp )
+        return backend_find(fd->use_mb ? "omp-magicbox" : "omp");
+
+    return backend_find(fd->use_mb ? "magicbox" : "pthreads");
+}
+
+///////////////////////////////////////
+const backend*
+backend_get(int i)
+{
+    return &registry[i];
+}
+
+///////////////////////////////////////
+int
+backend_count()
+{
+    return NBACKENDS;
+}
+
+///////////////////////////////////////
+void
+backend_list()
+{
+    int i;
+
+    printf("Backends:\n");
+    for ( i = 0; i < NBACKENDS; i++ )
+        printf("  %-14s%s\n", registry[i].name, registry[i].about);
+}
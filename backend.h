@@ -0,0 +1,27 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef BACKENDH
+#define BACKENDH
+
+#include "mandelbrot_set.h"
+
+/* an engine rendering the whole picture described by fdata */
+typedef struct {
+    const char* name;
+    const char* about;
+    int use_mb, use_omp;	/* what the backend needs set in fdata */
+    int (*render)(const fdata*);
+} backend;
+
+extern int backend_find(const char* name);
+extern int backend_default(const fdata*);
+extern const backend* backend_get(int);
+extern int backend_count();
+extern void backend_list();
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Gestosc orbit (Buddhabrot)
+ * Orbit-density rendering (Buddhabrot)
+ *
+ * Points c are drawn at random from the square [-2, 2] x [-2, 2]; for
+ * every c which escapes within maxiter iterations its whole orbit is
+ * replayed and every Zn lying in the view adds one to its pixel. The
+ * picture is the density of those hits.
+ *
+ * Every thread has a private histogram, so the hot loop has no atomics;
+ * the histograms are then added pairwise in log2(threads) steps. Samples
+ * come in blocks seeded by the block's number, so the picture does not
+ * depend on the number of threads nor on the schedule.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "buddhabrot.h"
+
+#define BUDDHA_BLOCK	65536	/* samples drawn from one seed */
+
+///////////////////////////////////////
+
+static inline uint64_t
+splitmix64(uint64_t* s)
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static inline double
+uniform(uint64_t* s)
+{
+    return (splitmix64(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+///////////////////////////////////////
+
+static inline int
+in_bulbs(double x, double y)
+    /* the main cardioid and the period-2 bulb never escape, so they need no iterating */
+{
+    double q = (x - 0.25) * (x - 0.25) + y * y;
+
+    if ( q * (q + (x - 0.25)) <= 0.25 * y * y )
+        return 1;
+    return (x + 1) * (x + 1) + y * y <= 0.0625;
+}
+
+///////////////////////////////////////
+
+static long long
+sample_block(const fdata* fd, long long b, long long count, uint32_t* h, long long* rejected)
+    /* draws count samples of block b into the histogram h, returns the number of escaping orbits */
+{
+    uint64_t seed = (uint64_t)b;
+    double T2 = fd->T * fd->T;
+    double xmin = fd->xmin, ymin = fd->ymin;
+    double ix = 1 / fd->xdiff, iy = 1 / fd->ydiff;
+    int n = fd->resolution, maxiter = fd->maxiter;
+    int xo = fd->xo, yo = fd->yo;
+    long long k, orbits = 0;
+    double cx, cy, zx, zy, t;
+    int i, j, px, py;
+
+    for ( k = 0; k < count; k++ ) {
+        cx = 4 * uniform(&seed) - 2;
+        cy = 4 * uniform(&seed) - 2;
+
+        if ( in_bulbs(cx, cy) ) {
+            (*rejected)++;
+            continue;
+        }
+
+        /* the loop of fractal_point: does the orbit escape? */
+        for ( i = 1, zx = cx, zy = cy; zx * zx + zy * zy < T2 && i < maxiter+1; i++ ) {
+            t = zx * zx - zy * zy + cx;
+            zy = 2 * zx * zy + cy;
+            zx = t;
+        }
+        if ( i == maxiter+1 )
+            continue;
+        orbits++;
+
+        /* the same orbit once more, this time into the histogram */
+        for ( j = 1, zx = cx, zy = cy; j < i; j++ ) {
+            px = (int)floor((zx - xmin) * ix) - xo;
+            py = (int)floor((zy - ymin) * iy) - yo;
+            if ( px >= 0 && px < n && py >= 0 && py < n )
+                h[(size_t)py * n + px]++;
+
+            t = zx * zx - zy * zy + cx;
+            zy = 2 * zx * zy + cy;
+            zx = t;
+        }
+    }
+
+    return orbits;
+}
+
+///////////////////////////////////////
+
+static void
+to_levels(const fdata* fd, const uint32_t* h)
+    /* densities -> 0..255 in tab, square root of the density relative to the highest one */
+{
+    int n = fd->resolution;
+    char** tab = fd->tab;
+    size_t p, npix = (size_t)n * n;
+    uint32_t top = 0;
+    long y;
+
+#pragma omp parallel for default(none) shared(h, npix) reduction(max:top) schedule(static)
+    for ( p = 0; p < npix; p++ )
+        if ( h[p] > top )
+            top = h[p];
+
+#pragma omp parallel for default(none) shared(h, tab, n, top) schedule(static)
+    for ( y = 0; y < n; y++ ) {
+        int x;
+
+        for ( x = 0; x < n; x++ )
+            tab[y][x] = top ? (unsigned char)(255 * sqrt((double)h[(size_t)y * n + x] / top)) : 0;
+    }
+}
+
+///////////////////////////////////////
+int
+buddha_render(fdata* fd, long long samples)
+{
+    size_t npix = (size_t)fd->resolution * fd->resolution;
+    long long blocks = (samples + BUDDHA_BLOCK - 1) / BUDDHA_BLOCK;
+    long long orbits = 0, rejected = 0;
+    uint32_t** hist;
+    int team = 1, failed = 0;
+    double t;
+
+#ifdef DEBUG
+    printf("[Buddhabrot]->buddha_render: %lld samples\n", samples);
+#endif
+
+    omp_set_num_threads(fd->num_proc);
+    hist = (uint32_t**)calloc(fd->num_proc, sizeof(uint32_t*));
+
+    t = - omp_get_wtime();
+#pragma omp parallel default(none) shared(fd, hist, npix, blocks, samples, team, failed) reduction(+:orbits, rejected)
+    {
+        int id = omp_get_thread_num(), s;
+        long long b;
+        size_t p;
+        uint32_t* h;
+
+        /* zeroed by the thread itself, so its pages are on its NUMA node */
+        h = hist[id] = (uint32_t*)malloc(npix * sizeof(uint32_t));
+        if ( h == NULL ) {
+#pragma omp atomic write
+            failed = 1;
+        } else
+            memset(h, 0, npix * sizeof(uint32_t));
+#pragma omp single
+        team = omp_get_num_threads();
+
+        if ( ! failed ) {
+#pragma omp for schedule(dynamic, 1)
+            for ( b = 0; b < blocks; b++ )
+                orbits += sample_block(fd, b, ( b < blocks - 1 ) ? BUDDHA_BLOCK : samples - b * BUDDHA_BLOCK, h, &rejected);
+
+            /* tree reduction: in the step s thread id takes the histogram of id + s */
+            for ( s = 1; s < team; s *= 2 ) {
+#pragma omp barrier
+                if ( id % (2 * s) == 0 && id + s < team ) {
+                    const uint32_t* o = hist[id + s];
+
+                    for ( p = 0; p < npix; p++ )
+                        h[p] += o[p];
+                }
+            }
+        }
+    }
+    t += omp_get_wtime();
+
+    if ( failed ) {
+        printf("Error: Not enough memory for %d histograms of the Buddhabrot\n", team);
+    } else {
+        to_levels(fd, hist[0]);
+        printf("[Buddhabrot]->%lld samples (%.3g/s), %lld orbits (%.3g/s), %lld rejected by the cardioid/bulb test\n",
+                samples, samples / t, orbits, orbits / t, rejected);
+    }
+
+    for ( team = 0; team < fd->num_proc; team++ )
+        free(hist[team]);
+    free(hist);
+
+    return failed;
+}
@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef BUDDHABROTH
+#define BUDDHABROTH
+
+#include "mandelbrot_set.h"
+
+extern int buddha_render(fdata*, long long samples);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Samosprawdzenie
+ * Self-check of the backends
+ *
+ * Every canonical viewport is rendered by the sequential backend, whose
+ * checksum has to be the golden one, and then by every backend of the
+ * registry with -n threads. The row backends have to give exactly the same
+ * picture; MagicBox fills whole boxes from their borders, so it may differ
+ * and its share of different pixels is reported and has to stay below
+ * CHECK_MB_TOLERANCE.
+ *
+ * The throughput of every viewport and backend is compared with the one
+ * kept for this machine in the baseline file; less than CHECK_SLOWDOWN of
+ * it fails. A missing line is written from this run, "update" rewrites
+ * them all.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <stdint.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "check.h"
+#include "formula.h"
+#include "backend.h"
+
+#define CHECK_RES		256	/* side of the pictures */
+#define CHECK_RUNS		3	/* renders of every picture, the fastest one counts */
+#define CHECK_MB_TOLERANCE	1.0	/* most MagicBox pixels different from the reference (%) */
+#define CHECK_SLOWDOWN		0.75	/* least throughput relative to the baseline */
+#define CHECK_LINE		512
+
+typedef struct {
+    const char* name;
+    double xmin, xmax, ymin, ymax;
+    int maxiter;
+    int formula, power;
+    double jre, jim;
+    uint64_t golden;	/* checksum of the sequential picture */
+} viewport;
+
+static const viewport views[] = {
+    { "full",		-2.0, 2.0, -2.0, 2.0,		200,	F_MANDELBROT, 2, 0, 0,	0xbaa509ac70fa6dd5ULL },
+    { "seahorse",	-0.80, -0.70, 0.05, 0.15,	1000,	F_MANDELBROT, 2, 0, 0,	0xb7770870e533972dULL },
+    { "elephant",	0.25, 0.35, -0.05, 0.05,	1000,	F_MANDELBROT, 2, 0, 0,	0x05669b2aab35e75bULL },
+    { "minibrot",	-1.7690, -1.7684, -0.0003, 0.0003,	2000,	F_MANDELBROT, 2, 0, 0,	0x650ab67e96e7a135ULL },
+    { "julia",		-1.6, 1.6, -1.6, 1.6,		500,	F_JULIA, 2, -0.8, 0.156,	0x397d62f7a64eb971ULL },
+    { "multibrot3",	-1.5, 1.5, -1.5, 1.5,		300,	F_MULTIBROT, 3, 0, 0,	0x44824fb6433a9479ULL },
+    { "burningship",	-1.80, -1.70, -0.09, 0.01,	500,	F_BURNING_SHIP, 2, 0, 0,	0x025381fffa530f1dULL },
+};
+
+#define NVIEWS	(int)(sizeof(views) / sizeof(views[0]))
+
+///////////////////////////////////////
+
+static uint64_t
+checksum(const fdata* fd)
+    /* FNV-1a of the table, row by row */
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int x, y;
+
+    for ( y = 0; y < fd->resolution; y++ )
+        for ( x = 0; x < fd->resolution; x++ ) {
+            h ^= (unsigned char)fd->tab[y][x];
+            h *= 0x100000001b3ULL;
+        }
+
+    return h;
+}
+
+///////////////////////////////////////
+
+static double
+render(fdata* fd, int backend)
+    /* renders the picture with the backend, returns pixels per second of the fastest run */
+{
+    double t, best = -1;
+    int r;
+
+    fd->backend = backend;
+    fd->use_mb = backend_get(backend)->use_mb;
+    fd->use_omp = backend_get(backend)->use_omp;
+    for ( r = 0; r < CHECK_RUNS; r++ ) {
+        fd->touch = 1;
+        t = - omp_get_wtime();
+        backend_get(backend)->render(fd);
+        t += omp_get_wtime();
+        if ( best < 0 || t < best )
+            best = t;
+    }
+
+    return (double)fd->resolution * fd->resolution / best;
+}
+
+///////////////////////////////////////
+
+static long
+differ(const fdata* a, const fdata* b)
+{
+    long d = 0;
+    int x, y;
+
+    for ( y = 0; y < a->resolution; y++ )
+        for ( x = 0; x < a->resolution; x++ )
+            d += a->tab[y][x] != b->tab[y][x];
+
+    return d;
+}
+
+///////////////////////////////////////
+
+static double
+baseline_get(const char* file, const char* key)
+    /* throughput kept for key, -1 if there is none */
+{
+    char line[CHECK_LINE];
+    size_t kl = strlen(key);
+    double v = -1;
+    FILE* fp = fopen(file, "r");
+
+    if ( fp == NULL )
+        return -1;
+    while ( fgets(line, sizeof(line), fp) != NULL )
+        if ( ! strncmp(line, key, kl) && line[kl] == ' ' && sscanf(line + kl, "%lf", &v) == 1 )
+            break;
+    fclose(fp);
+
+    return v;
+}
+
+///////////////////////////////////////
+
+static void
+baseline_put(const char* file, const char* key, double v)
+    /* replaces the line of key */
+{
+    char line[CHECK_LINE], tmp[CHECK_LINE];
+    size_t kl = strlen(key);
+    FILE *in, *out;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    if ( (out = fopen(tmp, "w")) == NULL ) {
+        perror("[Check]->baseline_put");
+        return;
+    }
+    if ( (in = fopen(file, "r")) != NULL ) {
+        while ( fgets(line, sizeof(line), in) != NULL )
+            if ( strncmp(line, key, kl) || line[kl] != ' ' )
+                fputs(line, out);
+        fclose(in);
+    }
+    fprintf(out, "%s %.6g\n", key, v);
+    fclose(out);
+
+    if ( rename(tmp, file) )
+        perror("[Check]->baseline_put");
+}
+
+///////////////////////////////////////
+
+static int
+alloc_tab(fdata* fd)
+{
+    int i, n = fd->resolution;
+
+    fd->tab = (char**)malloc(n * sizeof(char*));
+    if ( fd->tab == NULL || (fd->tab[0] = (char*)malloc((size_t)n * n)) == NULL ) {
+        free(fd->tab);
+        fd->tab = NULL;
+        return 1;
+    }
+    for ( i = 1; i < n; i++ )
+        fd->tab[i] = fd->tab[0] + (size_t)i * n;
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+selfcheck(const fdata* base, const char* baseline, int update)
+{
+    fdata ref, fd;
+    char host[64], key[CHECK_LINE];
+    const char* verdict;
+    uint64_t sum;
+    double rate, tput, was;
+    long d;
+    int v, b, failed = 0, checks = 0;
+
+#ifdef DEBUG
+    printf("[Check]->selfcheck: %d threads, baseline %s\n", base->num_proc, baseline);
+#endif
+
+    if ( gethostname(host, sizeof(host)) )
+        strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+
+    ref = *base;
+    ref.resolution = CHECK_RES;
+    ref.sbs = box_size(CHECK_RES, 4);
+    ref.rowdone = NULL;
+    ref.cancel = NULL;
+    ref.groups = 0;
+    ref.hosts = NULL;
+    ref.use_de = 0;
+    ref.xo = ref.yo = 0;
+    fd = ref;
+    if ( alloc_tab(&ref) || alloc_tab(&fd) ) {
+        printf("Error: Not enough memory for the self-check\n");
+        return 1;
+    }
+
+    for ( v = 0; v < NVIEWS; v++ ) {
+        const viewport* w = &views[v];
+
+        ref.xmin = fd.xmin = w->xmin;
+        ref.xmax = fd.xmax = w->xmax;
+        ref.ymin = fd.ymin = w->ymin;
+        ref.ymax = fd.ymax = w->ymax;
+        ref.xdiff = fd.xdiff = (w->xmax - w->xmin) / CHECK_RES;
+        ref.ydiff = fd.ydiff = (w->ymax - w->ymin) / CHECK_RES;
+        ref.maxiter = fd.maxiter = w->maxiter;
+        ref.formula = fd.formula = w->formula;
+        ref.power = fd.power = w->power;
+        ref.jre = fd.jre = w->jre;
+        ref.jim = fd.jim = w->jim;
+
+        /* the reference; the kernel must not have changed */
+        ref.num_proc = 1;
+        render(&ref, backend_find("sq"));
+        sum = checksum(&ref);
+        checks++;
+        if ( sum != w->golden ) {
+            printf("[Check]->%-12s golden checksum %016llx, sequential picture %016llx  FAIL\n", w->name,
+                    (unsigned long long)w->golden, (unsigned long long)sum);
+            failed++;
+        }
+
+        for ( b = 0; b < backend_count(); b++ ) {
+            fd.num_proc = strcmp(backend_get(b)->name, "sq") ? base->num_proc : 1;
+            tput = render(&fd, b);
+            d = differ(&ref, &fd);
+            rate = 100.0 * d / ((double)CHECK_RES * CHECK_RES);
+
+            snprintf(key, sizeof(key), "%s %ld %s %s %d", host, sysconf(_SC_NPROCESSORS_ONLN), w->name,
+                    backend_get(b)->name, fd.num_proc);
+            was = update ? -1 : baseline_get(baseline, key);
+            if ( was < 0 )
+                baseline_put(baseline, key, tput);
+
+            verdict = "OK";
+            if ( d > 0 && (! fd.use_mb || rate > CHECK_MB_TOLERANCE) )
+                verdict = "FAIL (picture)";
+            else if ( was > 0 && tput < CHECK_SLOWDOWN * was )
+                verdict = "FAIL (slower)";
+            checks++;
+            if ( strcmp(verdict, "OK") )
+                failed++;
+
+            printf("[Check]->%-12s %-13s %3d threads: %6ld px differ (%.3f%%), %.3g px/s",
+                    w->name, backend_get(b)->name, fd.num_proc, d, rate, tput);
+            if ( was > 0 )
+                printf(", baseline %.3g (%.0f%%)", was, 100 * tput / was);
+            printf("  %s\n", verdict);
+        }
+    }
+
+    printf("[Check]->%d checks, %d failed\n", checks, failed);
+
+    free(ref.tab[0]);
+    free(ref.tab);
+    free(fd.tab[0]);
+    free(fd.tab);
+
+    return failed != 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef CHECKH
+#define CHECKH
+
+#include "mandelbrot_set.h"
+
+extern int selfcheck(const fdata*, const char* baseline, int update);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Checkpointing of long renders
+ *
+ * tab lives in a memory-mapped file, so the compute threads write their
+ * results straight into the page cache and only flag finished rows.
+ * A separate thread wakes up every period seconds, flushes the rows
+ * finished since its last visit and only then marks them in the file's
+ * row bitmap; a row found in the bitmap is therefore always on disk.
+ * After a crash the render is started again with --resume and the backends
+ * skip the rows already done.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mandelbrot_set.h"
+#include "checkpoint.h"
+
+#define CKPT_MAGIC	0x54504b43	/* "CKPT" */
+#define CKPT_VERSION	3
+
+/*
+ * Layout of the file: header, one byte per row (1 - row is on disk),
+ * then the pixels row by row starting at offset data and, when the picture
+ * keeps them, their full counts row by row starting at offset counts
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t resolution;
+    int32_t maxiter;
+    double xmin, xmax;
+    double ymin, ymax;
+    double T;
+    int32_t formula, power;	/* fractal family */
+    double jre, jim;
+    uint64_t data;		/* offset of the first pixel */
+    uint64_t counts;	/* offset of the first full count, 0 if there are none */
+} ckpt_header;
+
+static char* base = NULL;	/* mapped file */
+static size_t baselen = 0;
+static char* saved = NULL;	/* row bitmap in the file */
+static const char* fname = NULL;
+
+static pthread_t flusher;
+static pthread_mutex_t cmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cwake = PTHREAD_COND_INITIALIZER;
+static int stop = 0;
+static int cperiod = 10;
+
+///////////////////////////////////////
+
+static int
+flush_rows(const fdata* fd)
+    /* puts the rows finished since the last call on disk, returns the number of rows there */
+{
+    const ckpt_header* h = (const ckpt_header*)base;
+    long page = sysconf(_SC_PAGESIZE);
+    int y, done = 0, fresh = 0;
+    uintptr_t lo, hi;
+
+    for ( y = 0; y < fd->resolution; y++ ) {
+        if ( saved[y] ) {
+            done++;
+            continue;
+        }
+        if ( ! __atomic_load_n(&fd->rowdone[y], __ATOMIC_ACQUIRE) )
+            continue;
+
+        /* the row's pages go to disk before its flag does */
+        lo = (uintptr_t)(base + h->data + (size_t)y * fd->resolution) & ~(uintptr_t)(page - 1);
+        hi = (uintptr_t)(base + h->data + (size_t)(y + 1) * fd->resolution);
+        if ( msync((void*)lo, hi - lo, MS_SYNC) ) {
+            perror("[Checkpoint]->msync");
+            continue;
+        }
+        if ( h->counts ) {
+            lo = (uintptr_t)(base + h->counts + (size_t)y * fd->resolution * sizeof(int32_t)) & ~(uintptr_t)(page - 1);
+            hi = (uintptr_t)(base + h->counts + (size_t)(y + 1) * fd->resolution * sizeof(int32_t));
+            if ( msync((void*)lo, hi - lo, MS_SYNC) ) {
+                perror("[Checkpoint]->msync");
+                continue;
+            }
+        }
+        saved[y] = 1;
+        done++;
+        fresh++;
+    }
+    if ( fresh )
+        msync(base, h->data, MS_ASYNC);
+
+    return done;
+}
+
+///////////////////////////////////////
+
+static void*
+flush_loop(void* d)
+{
+    const fdata* fd = (const fdata*)d;
+    struct timespec ts;
+    int done, last = -1;
+
+    pthread_mutex_lock(&cmutex);
+    while ( ! stop ) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += cperiod;
+        pthread_cond_timedwait(&cwake, &cmutex, &ts);
+        if ( stop )
+            break;
+
+        pthread_mutex_unlock(&cmutex);
+        done = flush_rows(fd);
+        if ( done != last ) {
+            printf("[Checkpoint]->Rows on disk: %d/%d (%.1f%%)\n", done, fd->resolution,
+                    100.0 * done / fd->resolution);
+            fflush(stdout);
+            last = done;
+        }
+        pthread_mutex_lock(&cmutex);
+    }
+    pthread_mutex_unlock(&cmutex);
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+same_picture(const ckpt_header* h, const fdata* fd, uint64_t counts)
+{
+    return h->magic == CKPT_MAGIC && h->version == CKPT_VERSION && h->counts == counts
+        && h->resolution == fd->resolution && h->maxiter == fd->maxiter
+        && h->xmin == fd->xmin && h->xmax == fd->xmax
+        && h->ymin == fd->ymin && h->ymax == fd->ymax && h->T == fd->T
+        && h->formula == fd->formula && h->power == fd->power && h->jre == fd->jre && h->jim == fd->jim;
+}
+
+///////////////////////////////////////
+int
+checkpoint_open(fdata* fd, const char* file, int resume, int period, int wide)
+    /*
+     * maps the checkpoint file as fd->tab, and as fd->counts too with wide;
+     * with resume the rows already saved in it are flagged as done,
+     * otherwise the file is started anew
+     */
+{
+    int cfd, i, done = 0;
+    struct stat st;
+    uint64_t data, counts = 0;
+    ckpt_header* h;
+
+#ifdef DEBUG
+    printf("[Main]->checkpoint_open: %s\n", file);
+#endif
+
+    data = (sizeof(ckpt_header) + fd->resolution + 4095) & ~(uint64_t)4095;
+    baselen = data + (size_t)fd->resolution * fd->resolution;
+    if ( wide ) {
+        counts = (baselen + 4095) & ~(uint64_t)4095;
+        baselen = counts + (size_t)fd->resolution * fd->resolution * sizeof(int32_t);
+    }
+
+    cfd = open(file, resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( cfd < 0 ) {
+        perror("[Main]->open checkpoint");
+        return 1;
+    }
+    if ( resume && ( fstat(cfd, &st) || (size_t)st.st_size != baselen ) ) {
+        printf("Error: Checkpoint %s does not match the picture\n", file);
+        close(cfd);
+        return 1;
+    }
+    if ( ! resume && ftruncate(cfd, baselen) ) {
+        perror("[Main]->ftruncate checkpoint");
+        close(cfd);
+        return 1;
+    }
+
+    base = (char*)mmap(NULL, baselen, PROT_READ | PROT_WRITE, MAP_SHARED, cfd, 0);
+    close(cfd);
+    if ( base == MAP_FAILED ) {
+        perror("[Main]->mmap checkpoint");
+        base = NULL;
+        return 1;
+    }
+    h = (ckpt_header*)base;
+    saved = base + sizeof(ckpt_header);
+
+    if ( resume ) {
+        if ( ! same_picture(h, fd, counts) ) {
+            printf("Error: Checkpoint %s was made for other parameters\n", file);
+            munmap(base, baselen);
+            base = NULL;
+            return 1;
+        }
+    } else {
+        h->magic = CKPT_MAGIC;
+        h->version = CKPT_VERSION;
+        h->resolution = fd->resolution;
+        h->maxiter = fd->maxiter;
+        h->xmin = fd->xmin, h->xmax = fd->xmax;
+        h->ymin = fd->ymin, h->ymax = fd->ymax;
+        h->T = fd->T;
+        h->formula = fd->formula, h->power = fd->power;
+        h->jre = fd->jre, h->jim = fd->jim;
+        h->data = data;
+        h->counts = counts;
+        msync(base, data, MS_SYNC);
+    }
+
+    fd->tab = (char**)malloc(fd->resolution * sizeof(char*));
+    fd->rowdone = (char*)malloc(fd->resolution);
+    fd->counts = wide ? (int**)malloc(fd->resolution * sizeof(int*)) : NULL;
+    for(i=0; i < fd->resolution; i++) {
+        fd->tab[i] = base + data + (size_t)i * fd->resolution;
+        if ( wide )
+            fd->counts[i] = (int*)(base + counts) + (size_t)i * fd->resolution;
+        fd->rowdone[i] = saved[i];
+        done += saved[i];
+    }
+    if ( resume )
+        printf("[Checkpoint]->Resuming, rows on disk: %d/%d\n", done, fd->resolution);
+
+    fname = file;
+    stop = 0;
+    cperiod = period > 0 ? period : 1;
+    if ( pthread_create(&flusher, NULL, flush_loop, (void*)fd) ) {
+        printf("Error: Cannot start the checkpoint thread\n");
+        munmap(base, baselen);
+        base = NULL;
+        free(fd->tab);
+        fd->tab = NULL;
+        free(fd->counts);
+        fd->counts = NULL;
+        free(fd->rowdone);
+        fd->rowdone = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+checkpoint_close(fdata* fd, int finished)
+    /* stops the flusher; a finished picture does not need its checkpoint any more */
+{
+    if ( base == NULL )
+        return 0;
+
+    pthread_mutex_lock(&cmutex);
+    stop = 1;
+    pthread_cond_signal(&cwake);
+    pthread_mutex_unlock(&cmutex);
+    pthread_join(flusher, NULL);
+
+    if ( ! finished )
+        flush_rows(fd);
+
+    munmap(base, baselen);
+    base = NULL;
+    saved = NULL;
+    if ( finished )
+        unlink(fname);
+
+    free(fd->tab);
+    fd->tab = NULL;
+    free(fd->counts);
+    fd->counts = NULL;
+    free(fd->rowdone);
+    fd->rowdone = NULL;
+
+    return 0;
+}
+
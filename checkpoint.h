@@ -0,0 +1,16 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef CHECKPOINTH
+#define CHECKPOINTH
+
+#include "mandelbrot_set.h"
+
+extern int checkpoint_open(fdata*, const char* file, int resume, int period, int wide);
+extern int checkpoint_close(fdata*, int finished);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Kolorowanie obrazu
+ * Colouring stage: iteration counts -> RGB
+ *
+ * Every colour depends only on the pixel's value, so the mapping is
+ * a lookup table of LUT_SIZE entries. The classic mapping of write_ppm
+ * is one such table; histogram equalization builds another one from
+ * the cumulative distribution of the iteration counts, so that every
+ * colour of the palette covers about the same number of pixels.
+ *
+ * tab holds the counts modulo 256. Once maxiter does not fit in it,
+ * escaped points would fall into the bins of others and of the set, so
+ * the palette and equalized colours are then looked up by the full counts
+ * the render keeps in fdata.counts, in a table of maxiter+1 entries.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+#define PALETTE_MAX	4096
+
+///////////////////////////////////////
+int
+load_palette(const char* file, palette* p)
+    /* palette file: one "r g b" line per colour, lines which do not parse are skipped */
+{
+    FILE* fp;
+    char line[256];
+    int r, g, b;
+
+    p->n = 0;
+    p->c = NULL;
+
+    fp = fopen(file, "r");
+    if ( fp == NULL ) {
+        perror("[Main]->load_palette");
+        return 1;
+    }
+
+    p->c = (rgb_t*)malloc(PALETTE_MAX * sizeof(rgb_t));
+    while ( p->n < PALETTE_MAX && fgets(line, sizeof(line), fp) != NULL ) {
+        if ( line[0] == '#' || sscanf(line, "%d %d %d", &r, &g, &b) != 3 )
+            continue;
+        p->c[p->n][0] = r & 0xff;
+        p->c[p->n][1] = g & 0xff;
+        p->c[p->n][2] = b & 0xff;
+        p->n++;
+    }
+    fclose(fp);
+
+    if ( p->n < 2 ) {
+        printf("Error: Palette %s has less than 2 colours\n", file);
+        free_palette(p);
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+void
+free_palette(palette* p)
+{
+    free(p->c);
+    p->c = NULL;
+    p->n = 0;
+}
+
+///////////////////////////////////////
+
+static void
+classic_lut(rgb_t* lut, int size)
+    /* the mapping write_ppm has always used */
+{
+    int i;
+    char colour, r, g, b;
+
+    for ( i = 0; i < size; i++ ) {
+        colour = (char)i;
+        r = g = (9 * colour) % 255;
+        /* kolejne kolory teczy. najbardziej rzadkie to najdluzsza fala -> czerwone, najczestsze to krotka fala - fiolet */
+        b = (r ^ g) % 255;
+        lut[i][0] = r;
+        lut[i][1] = g;
+        lut[i][2] = b;
+    }
+}
+
+///////////////////////////////////////
+
+static void
+histogram(const fdata* fd, long* hist, int size)
+    /* every thread counts its rows privately, the counts are then reduced */
+{
+    int y, x, n = fd->resolution;
+
+    memset(hist, 0, size * sizeof(long));
+
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, n, size) private(x) reduction(+:hist[:size]) schedule(static)
+    for ( y = 0; y < n; y++ )
+        for ( x = 0; x < n; x++ )
+            hist[colour_at(fd, x, y)]++;
+}
+
+///////////////////////////////////////
+int
+colour_wide(const fdata* fd, const palette* p, int equalize)
+    /* whether the colours need the full counts besides tab (fdata.counts) */
+{
+    return ( equalize || p != NULL ) && fd->maxiter >= LUT_SIZE;
+}
+
+///////////////////////////////////////
+int
+colour_size(const fdata* fd)
+    /* entries of the lookup table of the picture */
+{
+    return ( fd->counts != NULL ) ? fd->maxiter + 1 : LUT_SIZE;
+}
+
+///////////////////////////////////////
+int
+colour_lut(const fdata* fd, const palette* p, int equalize, rgb_t* lut)
+    /* builds the lookup table of colour_size entries, a NULL palette means a ramp like the classic one */
+{
+    long* hist;
+    long total, sum;
+    int i, k, inside, size = colour_size(fd);
+    rgb_t ramp[LUT_SIZE];
+    palette def;
+
+    if ( ! equalize && p == NULL ) {
+        classic_lut(lut, size);
+        return 0;
+    }
+    /* e.g. a picture read from shared memory has no counts besides tab */
+    if ( colour_wide(fd, p, equalize) && fd->counts == NULL ) {
+        printf("Error: Colours of maxiter above %d need the full iteration counts, the picture has none\n", LUT_SIZE - 1);
+        return 1;
+    }
+
+    if ( p == NULL ) {
+        for ( i = 0; i < LUT_SIZE; i++ ) {
+            ramp[i][0] = ramp[i][1] = i;
+            ramp[i][2] = 0;
+        }
+        def.n = LUT_SIZE;
+        def.c = ramp;
+        p = &def;
+    }
+
+    /* points which have not escaped are black; the entry is theirs alone unless maxiter does not fit in tab */
+    inside = colour_index(fd, fd->maxiter);
+
+    if ( ! equalize ) {
+        /* the palette is repeated along the iteration counts */
+        for ( i = 0; i < size; i++ )
+            memcpy(lut[i], p->c[i % p->n], sizeof(rgb_t));
+        memset(lut[inside], 0, sizeof(rgb_t));
+        return 0;
+    }
+
+    hist = (long*)malloc(size * sizeof(long));
+    if ( hist == NULL ) {
+        printf("Error: Not enough memory for the histogram\n");
+        return 1;
+    }
+    histogram(fd, hist, size);
+
+    total = 0;
+    for ( i = 0; i < size; i++ )
+        if ( i != inside )
+            total += hist[i];
+
+    sum = 0;
+    for ( i = 0; i < size; i++ ) {
+        if ( i == inside )
+            continue;
+        sum += hist[i];
+        k = total > 0 ? (int)((double)(p->n - 1) * sum / total) : 0;
+        memcpy(lut[i], p->c[k], sizeof(rgb_t));
+    }
+    memset(lut[inside], 0, sizeof(rgb_t));
+    free(hist);
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+density_lut(const palette* p, rgb_t* lut)
+    /* levels of a density picture (Buddhabrot): the palette stretched over them, grey without one */
+{
+    int i, k;
+
+    for ( i = 0; i < LUT_SIZE; i++ ) {
+        if ( p == NULL ) {
+            lut[i][0] = lut[i][1] = lut[i][2] = i;
+            continue;
+        }
+        k = i * (p->n - 1) / (LUT_SIZE - 1);
+        memcpy(lut[i], p->c[k], sizeof(rgb_t));
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+colour_apply(const fdata* fd, const rgb_t* lut, unsigned char* rgb)
+    /*
+     * rgb gets the picture as written into a PPM file, that is starting with
+     * the top row; rows are coloured in parallel
+     */
+{
+    int y, n = fd->resolution;
+
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, n, lut, rgb) schedule(static)
+    for ( y = 0; y < n; y++ ) {
+        unsigned char* __restrict out = rgb + (size_t)(n - 1 - y) * n * 3;
+        int x;
+
+        /* a gather from the table; no dependencies between pixels */
+        for ( x = 0; x < n; x++ ) {
+            const unsigned char* c = lut[colour_at(fd, x, y)];
+
+            out[3*x] = c[0];
+            out[3*x+1] = c[1];
+            out[3*x+2] = c[2];
+        }
+    }
+
+    return 0;
+}
+
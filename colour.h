@@ -0,0 +1,44 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef COLOURH
+#define COLOURH
+
+#include "mandelbrot_set.h"
+
+#define LUT_SIZE	256	/* tab keeps iteration counts in chars */
+
+typedef unsigned char rgb_t[3];
+
+typedef struct {
+    int n;			/* number of colours */
+    rgb_t* c;
+} palette;
+
+/* entry of the lookup table of escape time v */
+static inline int
+colour_index(const fdata* fd, int v)
+{
+    return ( fd->counts != NULL ) ? v : (unsigned char)v;
+}
+
+/* entry of the lookup table of pixel (x, y) */
+static inline int
+colour_at(const fdata* fd, int x, int y)
+{
+    return ( fd->counts != NULL ) ? fd->counts[y][x] : (unsigned char)fd->tab[y][x];
+}
+
+extern int load_palette(const char* file, palette*);
+extern void free_palette(palette*);
+extern int colour_wide(const fdata*, const palette*, int equalize);
+extern int colour_size(const fdata*);
+extern int colour_lut(const fdata*, const palette*, int equalize, rgb_t* lut);
+extern int density_lut(const palette*, rgb_t* lut);
+extern int colour_apply(const fdata*, const rgb_t* lut, unsigned char* rgb);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Renderowanie z terminem
+ * Deadline-bounded rendering
+ *
+ * The picture is rendered in passes, each one better than the one before:
+ * first 8, 4 and 2 times coarser (every pixel fills a block) with a low
+ * iteration cap, then in full resolution, then the points which have not
+ * escaped get twice as many iterations, again and again up to maxiter.
+ * The resolution passes go through the chosen backend; a watchdog thread
+ * raises fdata.cancel when the time is up and the workers stop between
+ * rows and boxes. Whatever the finished passes left in tab is the picture.
+ *
+ * A point which has not escaped within the cap is shown as the set, so
+ * with time enough the picture is the same as a render without deadline.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <time.h>
+#include <pthread.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "deadline.h"
+#include "formula.h"
+#include "backend.h"
+
+#define DL_COARSE	8	/* side of the block of the first pass (in pixels) */
+#define DL_MINROWS	16	/* passes of fewer rows are skipped */
+#define DL_CAP		255	/* iteration cap of the resolution passes, fits in a pixel */
+
+static pthread_mutex_t dmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dwake = PTHREAD_COND_INITIALIZER;
+static int finished;	/* the render is over before the deadline */
+static int expired;	/* the deadline has passed, seen by the workers through fdata.cancel */
+static struct timespec due;
+
+///////////////////////////////////////
+
+static void*
+watchdog(void*)
+{
+    pthread_mutex_lock(&dmutex);
+    while ( ! finished )
+        if ( pthread_cond_timedwait(&dwake, &dmutex, &due) == ETIMEDOUT ) {
+            __atomic_store_n(&expired, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    pthread_mutex_unlock(&dmutex);
+
+    return NULL;
+}
+
+///////////////////////////////////////
+
+static inline int
+settle(const fdata* fd, int v, int cap, unsigned char* unres)
+    /* a point still there after cap iterations is shown as the set until a deeper pass says otherwise */
+{
+    *unres = ( v == cap && cap < fd->maxiter );
+    return ( v == cap ) ? fd->maxiter : v;
+}
+
+///////////////////////////////////////
+
+static int
+scaled_pass(fdata* fd, int s, int cap, unsigned char* unres)
+    /* the picture s times coarser with at most cap iterations; returns the rows of tab replaced */
+{
+    int n = fd->resolution, m = (n + s - 1) / s;
+    int X, Y, x, y, rows = 0, complete;
+    fdata sub = *fd;
+    char* block;
+
+#ifdef DEBUG
+    printf("[Deadline]->scaled_pass: 1/%d, cap %d\n", s, cap);
+#endif
+
+    /* pixel (X, Y) lies in the middle of the block of s x s pixels of tab */
+    sub.resolution = m;
+    sub.xdiff = fd->xdiff * s;
+    sub.ydiff = fd->ydiff * s;
+    sub.xmax = sub.xmin + m * sub.xdiff;
+    sub.ymax = sub.ymin + m * sub.ydiff;
+    sub.maxiter = cap;
+    sub.sbs = ( fd->sbs / (s * s) > 0 ) ? fd->sbs / (s * s) : 1;
+    sub.touch = 1;
+    sub.counts = NULL;
+
+    sub.rowdone = (char*)calloc(m, sizeof(char));
+    sub.tab = (char**)malloc(m * sizeof(char*));
+    block = (char*)malloc((size_t)m * m);
+    if ( sub.rowdone == NULL || sub.tab == NULL || block == NULL ) {
+        printf("Error: Not enough memory for a pass of the deadline mode\n");
+        free(sub.rowdone);
+        free(sub.tab);
+        free(block);
+        return 0;
+    }
+    for ( Y = 0; Y < m; Y++ )
+        sub.tab[Y] = block + (size_t)Y * m;
+
+    backend_get(fd->backend)->render(&sub);
+
+    /* backends which do not report rows (MagicBox, collapsed loop) count only when they were not stopped */
+    complete = ! cancelled(fd);
+    for ( Y = 0; Y < m; Y++ ) {
+        if ( ! complete && ! sub.rowdone[Y] )
+            continue;
+        for ( y = Y * s; y < (Y + 1) * s && y < n; y++, rows++ )
+            for ( x = 0; x < n; x++ ) {
+                X = x / s;
+                put_count(fd, x, y, settle(fd, (unsigned char)sub.tab[Y][X], cap, &unres[(size_t)y * n + x]));
+            }
+    }
+
+    free(sub.rowdone);
+    free(sub.tab);
+    free(block);
+
+    return rows;
+}
+
+///////////////////////////////////////
+
+static long
+deepen(fdata* fd, int cap, unsigned char* unres)
+    /* the points which have not escaped yet get up to cap iterations; returns how many are still there */
+{
+    int n = fd->resolution;
+    fdata sub = *fd;
+    long left = 0;
+    int y;
+
+#ifdef DEBUG
+    printf("[Deadline]->deepen: cap %d\n", cap);
+#endif
+
+    /* these are few scattered points, so the rows go to OpenMP threads whatever the backend */
+    sub.maxiter = cap;
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, sub, unres, n, cap) reduction(+:left) schedule(dynamic, 1)
+    for ( y = 0; y < n; y++ ) {
+        unsigned char* u = unres + (size_t)y * n;
+        int x;
+
+        if ( ! cancelled(fd) )
+            for ( x = 0; x < n; x++ )
+                if ( u[x] )
+                    put_count(fd, x, y, settle(fd, pixel_point(&sub, x, y), cap, &u[x]));
+        for ( x = 0; x < n; x++ )
+            left += u[x];
+    }
+
+    return left;
+}
+
+///////////////////////////////////////
+int
+deadline_render(fdata* fd, int ms)
+{
+    int n = fd->resolution, s, rows, cap, capdone = 0;
+    int scale = 0, part = 0, prows = 0;	/* finest pass finished, the one stopped and its rows */
+    size_t p, npix = (size_t)n * n;
+    unsigned char* unres;	/* points shown as the set only because of the cap */
+    long left = 0;
+    pthread_t dog;
+    double t;
+
+#ifdef DEBUG
+    printf("[Deadline]->deadline_render: %d ms\n", ms);
+#endif
+
+    unres = (unsigned char*)calloc(npix, sizeof(unsigned char));
+    if ( unres == NULL ) {
+        printf("Error: Not enough memory for the deadline mode\n");
+        return 1;
+    }
+    /* rows no pass gets to stay blank */
+    for ( s = 0; s < n; s++ ) {
+        memset(fd->tab[s], 0, n);
+        if ( fd->counts != NULL )
+            memset(fd->counts[s], 0, n * sizeof(int));
+    }
+    fd->touch = 0;
+
+    finished = 0;
+    expired = 0;
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += ms / 1000;
+    due.tv_nsec += (long)(ms % 1000) * 1000000;
+    if ( due.tv_nsec >= 1000000000 ) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000;
+    }
+    if ( pthread_create(&dog, NULL, watchdog, NULL) ) {
+        printf("Error: Cannot start the deadline thread\n");
+        free(unres);
+        return 1;
+    }
+    fd->cancel = &expired;
+
+    t = - omp_get_wtime();
+    cap = ( fd->maxiter < DL_CAP ) ? fd->maxiter : DL_CAP;
+
+    /* coarse to fine */
+    for ( s = DL_COARSE; s >= 1 && ! cancelled(fd); s /= 2 ) {
+        if ( s > 1 && (n / s < DL_MINROWS || n / s < fd->num_proc) )
+            continue;
+        rows = scaled_pass(fd, s, cap, unres);
+        if ( rows == n )
+            scale = s;
+        else {
+            part = s;
+            prows = rows;
+        }
+    }
+
+    /* deeper and deeper where the points have not escaped yet */
+    for ( p = 0; p < npix; p++ )
+        left += unres[p];
+    if ( scale )
+        capdone = cap;
+    if ( scale == 1 ) {
+        while ( left > 0 && ! cancelled(fd) ) {
+            cap = ( cap > fd->maxiter / 2 ) ? fd->maxiter : 2 * cap;
+            left = deepen(fd, cap, unres);
+            if ( ! cancelled(fd) )
+                capdone = cap;
+        }
+        /* nothing left to deepen means the picture is the one of maxiter */
+        if ( left == 0 )
+            capdone = fd->maxiter;
+    }
+    t += omp_get_wtime();
+
+    pthread_mutex_lock(&dmutex);
+    finished = 1;
+    pthread_cond_signal(&dwake);
+    pthread_mutex_unlock(&dmutex);
+    pthread_join(dog, NULL);
+    fd->cancel = NULL;
+
+    /* quality report */
+    printf("[Deadline]->Budget %d ms, used %.1f ms%s\n", ms, t * 1000, expired ? " (expired)" : "");
+    if ( scale )
+        printf("[Deadline]->Resolution: 1/%d finished", scale);
+    else
+        printf("[Deadline]->Resolution: no pass finished");
+    if ( part )
+        printf(", 1/%d stopped at %d of %d rows (%.1f%%)", part, prows, n, 100.0 * prows / n);
+    printf("\n");
+    printf("[Deadline]->Iterations: %d of %d, %ld pixels (%.2f%%) shown as the set without reaching them\n",
+            capdone, fd->maxiter, left, 100.0 * left / npix);
+
+    free(unres);
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef DEADLINEH
+#define DEADLINEH
+
+#include "mandelbrot_set.h"
+
+extern int deadline_render(fdata*, int ms);
+
+#endif
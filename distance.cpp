@@ -0,0 +1,99 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Estymacja odleglosci od zbioru
+ * Exterior distance estimation
+ *
+ * Together with Zn the kernel tracks dZn/dc = 2 Zn dZ(n-1)/dc + 1.
+ * For an escaping point 0.5 |Zn| ln|Zn| / |dZn| is a lower bound of
+ * its distance to the set (Koebe 1/4 theorem), when Zn is large enough.
+ * If that bound exceeds the radius of a box, there is no point of the set
+ * in the box and, as its corners agree with the middle, the box is filled
+ * without iterating its pixels.
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <complex>
+
+#include "mandelbrot_set.h"
+#include "distance.h"
+
+using namespace std;
+
+#define DE_RADIUS	1000.0	/* escaped orbits continue up to this radius for a good estimate */
+#define DE_EXTRA	32	/* but no longer than that many iterations */
+
+///////////////////////////////////////
+int
+fractal_point_de(complex<double> c, const fdata *fd, double* de)
+    /* fractal_point which also gives the distance estimate, 0 for the points inside */
+{
+    complex<double> Zn, dZ;
+    int n, i, v;
+
+    *de = 0.0;
+    for ( n=1, Zn=c, dZ=1.0; abs(Zn)< fd->T && n < fd->maxiter+1; n++ ) {
+        dZ = 2.0 * Zn * dZ + 1.0;
+        Zn = Zn * Zn + c;
+    }
+    v = n-1; //due to the last incrementation in the FOR loop
+
+    if ( abs(c) >= fd->T )	//point is already over the range
+        v = 0;
+    if ( abs(Zn) < fd->T )	//point has not escaped
+        return v;
+
+    for ( i = 0; abs(Zn) < DE_RADIUS && i < DE_EXTRA; i++ ) {
+        dZ = 2.0 * Zn * dZ + 1.0;
+        Zn = Zn * Zn + c;
+    }
+    if ( abs(dZ) > 0.0 )
+        *de = 0.5 * abs(Zn) * log(abs(Zn)) / abs(dZ);
+
+    return v;
+}
+
+///////////////////////////////////////
+
+static inline int
+point(const fdata* fd, double x, double y)
+    /* value of the point (x, y) given in pixels */
+{
+    double de;
+
+    return fractal_point_de(complex<double>(fd->xmin+(fd->xo+x)*fd->xdiff, fd->ymin+(fd->yo+y)*fd->ydiff), fd, &de);
+}
+
+///////////////////////////////////////
+int
+exterior_cell(const fdata* fd, int yl, int yh, int xl, int xh, int* v)
+    /*
+     * whether the box of pixels [xl, xh) x [yl, yh) lies far enough from the set
+     * to be filled with *v without iterating its pixels
+     */
+{
+    double de, cx, cy, radius;
+
+    if ( xh <= xl || yh <= yl )
+        return 0;
+
+    cx = (xl + xh) / 2.0;
+    cy = (yl + yh) / 2.0;
+    *v = fractal_point_de(complex<double>(fd->xmin+(fd->xo+cx)*fd->xdiff, fd->ymin+(fd->yo+cy)*fd->ydiff), fd, &de);
+
+    /* from the middle to the farthest pixel's centre */
+    radius = hypot((xh - xl - 1) / 2.0 * fd->xdiff, (yh - yl - 1) / 2.0 * fd->ydiff);
+    if ( de <= radius )
+        return 0;
+
+    /* no point of the set inside; the iteration counts still have to agree */
+    return point(fd, xl+0.5, yl+0.5) == *v && point(fd, xh-0.5, yl+0.5) == *v
+        && point(fd, xl+0.5, yh-0.5) == *v && point(fd, xh-0.5, yh-0.5) == *v;
+}
+
@@ -0,0 +1,18 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef DISTANCEH
+#define DISTANCEH
+
+#include <complex>
+
+#include "mandelbrot_set.h"
+
+extern int fractal_point_de(std::complex<double> c, const fdata*, double* de);
+extern int exterior_cell(const fdata*, int yl, int yh, int xl, int xh, int* v);
+
+#endif
@@ -0,0 +1,677 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Rozdzielanie pracy pomiedzy procesy na roznych maszynach
+ * Distributing the work between processes on (possibly) different hosts
+ *
+ * The coordinator splits the picture into square tiles and sends them
+ * to worker processes (started with -w port) over TCP. Every worker renders
+ * its tile with the backend chosen on its own command line and sends back
+ * the raw iteration buffer, in full counts when the coordinator keeps them
+ * (fdata.counts). A tile held by a dead worker goes back to the pool,
+ * a tile held for too long by a slow one is handed out once more and
+ * the first result wins.
+ *
+ * Both sides are expected to share the byte order and the size of double.
+ * There is no authentication: a worker listens on the loopback unless told
+ * otherwise, and takes no tile larger than EDS_MAX_TILE from anybody.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mandelbrot_set.h"
+#include "distributor.h"
+#include "manager.h"
+
+#define EDS_MAGIC	0x33534445	/* "EDS3" */
+#define EDS_QUIT	0xffffffff	/* tile number ending the session */
+#define EDS_TIMEOUT	10.0	/* after that many seconds a tile is handed out once more */
+#define EDS_BIND	"127.0.0.1"	/* worker's address unless -w names one */
+
+/* coordinator -> worker */
+typedef struct {
+    uint32_t magic;
+    uint32_t tile;		/* tile's number, EDS_QUIT ends the session */
+    int32_t x, y;		/* pixel coordinates of the tile's corner */
+    int32_t size;		/* tile's side in pixels */
+    int32_t maxiter;
+    int32_t sbs;		/* smallest box size scaled to the tile */
+    int32_t formula, power;	/* fractal family */
+    int32_t wide;		/* whether the results are full counts (int32) instead of bytes */
+    double xmin, ymin;	/* corner of the whole picture */
+    double xdiff, ydiff;
+    double T;
+    double jre, jim;	/* c of the Julia set */
+} eds_job;
+
+/* worker -> coordinator, followed by size*size results, bytes or full counts */
+typedef struct {
+    uint32_t magic;
+    uint32_t tile;
+    int32_t size;
+    int32_t pad;
+} eds_result;
+
+/* the coordinator's view of a worker process */
+typedef struct {
+    int sock;		/* -1 when the worker is dead */
+    int tile;		/* tile being computed, -1 when idle */
+    eds_result hdr;
+    char* buf;		/* header followed by results */
+    size_t got, need;
+} peer;
+
+/* tile's state */
+enum { T_PENDING = 0, T_ASSIGNED, T_DONE };
+
+///////////////////////////////////////
+
+static double
+wtime()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec * 1E-6;
+}
+
+///////////////////////////////////////
+
+static int
+send_all(int sock, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = send(sock, p, len, MSG_NOSIGNAL);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return 1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+recv_all(int sock, void* buf, size_t len)
+{
+    char* p = (char*)buf;
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = recv(sock, p, len, 0);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return 1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+connect_to(const char* hostport)
+    /* hostport is host:port, returns a connected socket or -1 */
+{
+    char host[256];
+    const char* colon;
+    struct addrinfo hints, *res, *ai;
+    int sock = -1, one = 1;
+
+    colon = strrchr(hostport, ':');
+    if ( colon == NULL || colon - hostport >= (int)sizeof(host) ) {
+        printf("Error: Wrong worker address: %s\n", hostport);
+        return -1;
+    }
+    memcpy(host, hostport, colon - hostport);
+    host[colon - hostport] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ( getaddrinfo(host, colon + 1, &hints, &res) ) {
+        printf("Error: Cannot resolve worker address: %s\n", hostport);
+        return -1;
+    }
+
+    for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( sock < 0 )
+            continue;
+        if ( ! connect(sock, ai->ai_addr, ai->ai_addrlen) )
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if ( sock < 0 )
+        printf("Error: Cannot connect to worker %s\n", hostport);
+    else
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return sock;
+}
+
+///////////////////////////////////////
+
+static int
+send_tile(const fdata* fd, peer* p, int tile, int ntx)
+{
+    eds_job job;
+
+    memset(&job, 0, sizeof(job));
+    job.magic = EDS_MAGIC;
+    job.tile = tile;
+    job.x = (tile % ntx) * fd->tile;
+    job.y = (tile / ntx) * fd->tile;
+    job.size = fd->tile;
+    job.maxiter = fd->maxiter;
+    job.wide = ( fd->counts != NULL );
+    /* sbs is given in square pixels of the whole picture */
+    job.sbs = (int)((double)fd->sbs * fd->tile / fd->resolution * fd->tile / fd->resolution);
+    job.xmin = fd->xmin;
+    job.ymin = fd->ymin;
+    job.xdiff = fd->xdiff;
+    job.ydiff = fd->ydiff;
+    job.T = fd->T;
+    job.formula = fd->formula;
+    job.power = fd->power;
+    job.jre = fd->jre;
+    job.jim = fd->jim;
+
+#ifdef DEBUG
+    printf("\t[Coordinator]->Sending tile %d (%d, %d)\n", tile, job.x, job.y);
+#endif
+    p->tile = tile;
+    p->got = 0;
+    p->need = sizeof(eds_result);
+
+    return send_all(p->sock, &job, sizeof(job));
+}
+
+///////////////////////////////////////
+
+static void
+store_tile(const fdata* fd, const peer* p, int ntx)
+    /* copies the part of the tile that lies inside the picture */
+{
+    int x0 = (p->tile % ntx) * fd->tile;
+    int y0 = (p->tile / ntx) * fd->tile;
+    int x, y, w;
+    char* data = p->buf + sizeof(eds_result);
+    const int32_t* wide = (const int32_t*)data;
+
+    w = fd->resolution - x0 < fd->tile ? fd->resolution - x0 : fd->tile;
+    for ( y = 0; y < fd->tile && y0 + y < fd->resolution; y++ )
+        if ( fd->counts != NULL )
+            for ( x = 0; x < w; x++ )
+                put_count(fd, x0 + x, y0 + y, wide[(size_t)y * fd->tile + x]);
+        else
+            memcpy(fd->tab[y0 + y] + x0, data + (size_t)y * fd->tile, w);
+}
+
+///////////////////////////////////////
+
+static void
+drop_peer(peer* p, int* state, int* holders)
+{
+    printf("[Coordinator]->Worker lost, tile %d goes back to the pool\n", p->tile);
+    close(p->sock);
+    p->sock = -1;
+    if ( p->tile >= 0 && state[p->tile] != T_DONE && --holders[p->tile] == 0 )
+        state[p->tile] = T_PENDING;
+    p->tile = -1;
+}
+
+///////////////////////////////////////
+
+static int
+pick_tile(const int* state, const int* holders, const double* started, int ntiles, double now)
+    /* first pending tile, or the oldest one outstanding longer than EDS_TIMEOUT */
+{
+    int i, old = -1;
+
+    for ( i = 0; i < ntiles; i++ ) {
+        if ( state[i] == T_PENDING )
+            return i;
+        if ( state[i] == T_ASSIGNED && holders[i] == 1 && now - started[i] > EDS_TIMEOUT
+                && ( old < 0 || started[i] < started[old] ) )
+            old = i;
+    }
+
+    return old;
+}
+
+///////////////////////////////////////
+int
+coordinator(const fdata* fd)
+{
+    int i, n, npeers, alive, ntx, ntiles, done, tile;
+    int *state, *holders;
+    double* started;
+    char *hosts, *h, *save;
+    peer* peers;
+    struct pollfd* pfd;
+    ssize_t r;
+    size_t tsize = (size_t)fd->tile * fd->tile * ( fd->counts != NULL ? sizeof(int32_t) : 1 );
+    int rc = 0;
+
+#ifdef DEBUG
+    printf("[Coordinator]->coordinator: %s\n", fd->hosts);
+#endif
+
+    ntx = (fd->resolution + fd->tile - 1) / fd->tile;
+    ntiles = ntx * ntx;
+
+    /* connecting to workers */
+    if ( (hosts = strdup(fd->hosts)) == NULL ) {
+        printf("Error: Not enough memory for the coordinator\n");
+        return 1;
+    }
+    for ( npeers = 1, h = hosts; *h; h++ )
+        if ( *h == ',' )
+            npeers++;
+    peers = (peer*)calloc(npeers, sizeof(peer));
+    pfd = (struct pollfd*)calloc(npeers, sizeof(struct pollfd));
+    state = (int*)calloc(ntiles, sizeof(int));
+    holders = (int*)calloc(ntiles, sizeof(int));
+    started = (double*)calloc(ntiles, sizeof(double));
+    if ( peers == NULL || pfd == NULL || state == NULL || holders == NULL || started == NULL ) {
+        printf("Error: Not enough memory for the coordinator\n");
+        free(hosts);
+        free(peers);
+        free(pfd);
+        free(state);
+        free(holders);
+        free(started);
+        return 1;
+    }
+
+    alive = 0;
+    for ( i = 0, h = strtok_r(hosts, ",", &save); h != NULL; h = strtok_r(NULL, ",", &save), i++ ) {
+        peers[i].sock = connect_to(h);
+        peers[i].tile = -1;
+        peers[i].buf = (char*)malloc(sizeof(eds_result) + tsize);
+        if ( peers[i].sock >= 0 && peers[i].buf == NULL ) {
+            printf("Error: Not enough memory for the results of worker %s\n", h);
+            close(peers[i].sock);
+            peers[i].sock = -1;
+        }
+        if ( peers[i].sock >= 0 )
+            alive++;
+    }
+    npeers = i;
+    free(hosts);
+
+    done = 0;
+    while ( done < ntiles ) {
+        if ( alive == 0 ) {
+            printf("Error: No workers left, %d of %d tiles done\n", done, ntiles);
+            rc = 1;
+            break;
+        }
+
+        /* every idle worker gets a tile */
+        for ( i = 0; i < npeers; i++ ) {
+            if ( peers[i].sock < 0 || peers[i].tile >= 0 )
+                continue;
+            tile = pick_tile(state, holders, started, ntiles, wtime());
+            if ( tile < 0 )
+                break;
+            if ( state[tile] == T_ASSIGNED )
+                printf("[Coordinator]->Tile %d is late, handing it out once more\n", tile);
+            else
+                started[tile] = wtime();
+            state[tile] = T_ASSIGNED;
+            holders[tile]++;
+            if ( send_tile(fd, &peers[i], tile, ntx) ) {
+                drop_peer(&peers[i], state, holders);
+                alive--;
+            }
+        }
+
+        for ( i = 0; i < npeers; i++ ) {
+            pfd[i].fd = peers[i].tile >= 0 ? peers[i].sock : -1;
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        n = poll(pfd, npeers, 100);
+        if ( n < 0 && errno != EINTR ) {
+            perror("[Coordinator]->poll");
+            rc = 1;
+            break;
+        }
+        if ( n <= 0 )
+            continue;
+
+        for ( i = 0; i < npeers; i++ ) {
+            peer* p = &peers[i];
+
+            if ( pfd[i].fd < 0 || ! pfd[i].revents )
+                continue;
+
+            r = recv(p->sock, p->buf + p->got, p->need - p->got, 0);
+            if ( r < 0 && errno == EINTR )
+                continue;
+            if ( r <= 0 ) {
+                drop_peer(p, state, holders);
+                alive--;
+                continue;
+            }
+            p->got += r;
+            if ( p->got < p->need )
+                continue;
+
+            if ( p->need == sizeof(eds_result) ) {
+                /* header is complete, now the results */
+                memcpy(&p->hdr, p->buf, sizeof(eds_result));
+                if ( p->hdr.magic != EDS_MAGIC || (int)p->hdr.tile != p->tile || p->hdr.size != fd->tile ) {
+                    printf("[Coordinator]->Malformed result\n");
+                    drop_peer(p, state, holders);
+                    alive--;
+                    continue;
+                }
+                p->need += tsize;
+                continue;
+            }
+
+            /* the whole tile arrived; the first copy of it wins */
+            if ( state[p->tile] != T_DONE ) {
+                store_tile(fd, p, ntx);
+                state[p->tile] = T_DONE;
+                done++;
+#ifdef DEBUG
+                printf("\t[Coordinator]->Tile %d done (%d/%d)\n", p->tile, done, ntiles);
+#endif
+            }
+            holders[p->tile]--;
+            p->tile = -1;
+        }
+    }
+
+    /* finishing the session */
+    for ( i = 0; i < npeers; i++ ) {
+        if ( peers[i].sock >= 0 ) {
+            eds_job quit;
+
+            memset(&quit, 0, sizeof(quit));
+            quit.magic = EDS_MAGIC;
+            quit.tile = EDS_QUIT;
+            send_all(peers[i].sock, &quit, sizeof(quit));
+            close(peers[i].sock);
+        }
+        free(peers[i].buf);
+    }
+
+    free(state);
+    free(holders);
+    free(started);
+    free(pfd);
+    free(peers);
+
+    return rc;
+}
+
+///////////////////////////////////////
+
+static void
+free_tab(char** tab, int size)
+{
+    int y;
+
+    if ( tab == NULL )
+        return;
+    for ( y = 0; y < size; y++ )
+        free(tab[y]);
+    free(tab);
+}
+
+///////////////////////////////////////
+
+static char**
+alloc_tab(int size)
+    /* size rows of size bytes, NULL if there is no memory for all of them */
+{
+    char** tab;
+    int y;
+
+    if ( (tab = (char**)calloc(size, sizeof(char*))) == NULL )
+        return NULL;
+    for ( y = 0; y < size; y++ )
+        if ( (tab[y] = (char*)malloc(size * sizeof(char))) == NULL ) {
+            free_tab(tab, y);
+            return NULL;
+        }
+
+    return tab;
+}
+
+///////////////////////////////////////
+
+static void
+free_counts(int** counts, int size)
+{
+    int y;
+
+    if ( counts == NULL )
+        return;
+    for ( y = 0; y < size; y++ )
+        free(counts[y]);
+    free(counts);
+}
+
+///////////////////////////////////////
+
+static int**
+alloc_counts(int size)
+    /* size rows of size full counts, NULL if there is no memory for all of them */
+{
+    int** counts;
+    int y;
+
+    if ( (counts = (int**)calloc(size, sizeof(int*))) == NULL )
+        return NULL;
+    for ( y = 0; y < size; y++ )
+        if ( (counts[y] = (int*)malloc(size * sizeof(int))) == NULL ) {
+            free_counts(counts, y);
+            return NULL;
+        }
+
+    return counts;
+}
+
+///////////////////////////////////////
+
+static int
+serve_session(const fdata* wzor, int sock)
+    /* serves tiles until the coordinator says goodbye; returns 1 on QUIT */
+{
+    eds_job job;
+    eds_result res;
+    fdata sub;
+    char** tab = NULL;
+    int** counts = NULL;	/* kept for the jobs which want full counts */
+    int size = 0, y, rc = 0;
+
+    while ( ! recv_all(sock, &job, sizeof(job)) ) {
+        if ( job.magic != EDS_MAGIC ) {
+            printf("[Worker]->Malformed job\n");
+            break;
+        }
+        if ( job.tile == EDS_QUIT ) {
+            rc = 1;
+            break;
+        }
+        /* the job comes from anybody who can connect, so it is not trusted */
+        if ( job.size < 1 || job.size > EDS_MAX_TILE ) {
+            printf("[Worker]->Wrong tile size: %d\n", job.size);
+            break;
+        }
+        if ( job.maxiter < 1 ) {
+            printf("[Worker]->Wrong maxiter: %d\n", job.maxiter);
+            break;
+        }
+
+        if ( job.size != size ) {
+            free_tab(tab, size);
+            free_counts(counts, size);
+            counts = NULL;
+            size = job.size;
+            if ( (tab = alloc_tab(size)) == NULL ) {
+                printf("[Worker]->Not enough memory for a tile of %d\n", size);
+                size = 0;
+                break;
+            }
+        }
+        if ( job.wide && counts == NULL && (counts = alloc_counts(size)) == NULL ) {
+            printf("[Worker]->Not enough memory for the counts of a tile of %d\n", size);
+            break;
+        }
+
+        /* the tile is rendered as a small picture by the backend chosen on our command line */
+        memcpy(&sub, wzor, sizeof(fdata));
+        sub.hosts = NULL;
+        sub.tab = tab;
+        sub.counts = job.wide ? counts : NULL;
+        sub.resolution = job.size;
+        sub.maxiter = job.maxiter;
+        sub.T = job.T;
+        sub.formula = job.formula;
+        sub.power = job.power;
+        sub.jre = job.jre;
+        sub.jim = job.jim;
+        sub.sbs = job.sbs > 0 ? job.sbs : 1;
+        sub.xdiff = job.xdiff;
+        sub.ydiff = job.ydiff;
+        /* pixels are addressed relative to the whole picture so that c is computed exactly as there */
+        sub.xmin = job.xmin;
+        sub.ymin = job.ymin;
+        sub.xo = job.x;
+        sub.yo = job.y;
+        sub.xmax = sub.xmin + (job.x + job.size) * job.xdiff;
+        sub.ymax = sub.ymin + (job.y + job.size) * job.ydiff;
+
+#ifdef DEBUG
+        printf("[Worker]->Rendering tile %u (%d, %d)\n", job.tile, job.x, job.y);
+#endif
+        manager(&sub);
+
+        memset(&res, 0, sizeof(res));
+        res.magic = EDS_MAGIC;
+        res.tile = job.tile;
+        res.size = job.size;
+        if ( send_all(sock, &res, sizeof(res)) )
+            break;
+        for ( y = 0; y < size; y++ )
+            if ( job.wide ? send_all(sock, counts[y], size * sizeof(int32_t)) : send_all(sock, tab[y], size) )
+                break;
+        if ( y < size )
+            break;
+    }
+
+    free_tab(tab, size);
+    free_counts(counts, size);
+
+    return rc;
+}
+
+///////////////////////////////////////
+int
+serve(const fdata* wzor, const char* hostport)
+    /* worker process: renders tiles sent by a coordinator until it sends EDS_QUIT;
+       hostport is [host:]port, the host is EDS_BIND if not given */
+{
+    char host[256];
+    const char *colon, *port;
+    struct addrinfo hints, *res, *ai;
+    int lsock = -1, sock, one = 1;
+
+    colon = strrchr(hostport, ':');
+    if ( colon == NULL ) {
+        strcpy(host, EDS_BIND);
+        port = hostport;
+    } else if ( colon - hostport < (int)sizeof(host) ) {
+        memcpy(host, hostport, colon - hostport);
+        host[colon - hostport] = '\0';
+        port = colon + 1;
+    } else {
+        printf("Error: Wrong worker address: %s\n", hostport);
+        return 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if ( getaddrinfo(host, port, &hints, &res) ) {
+        printf("Error: Wrong worker address: %s\n", hostport);
+        return 1;
+    }
+
+    for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+        lsock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( lsock < 0 )
+            continue;
+        setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if ( ! bind(lsock, ai->ai_addr, ai->ai_addrlen) && ! listen(lsock, 4) )
+            break;
+        close(lsock);
+        lsock = -1;
+    }
+    freeaddrinfo(res);
+    if ( lsock < 0 ) {
+        perror("[Worker]->bind");
+        return 1;
+    }
+    printf("[Worker]->Listening on %s port %s\n", host, port);
+    fflush(stdout);
+    while ( 1 ) {
+        sock = accept(lsock, NULL, NULL);
+        if ( sock < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            perror("[Worker]->accept");
+            break;
+        }
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        /* a coordinator that vanished without EDS_QUIT may come back */
+        if ( serve_session(wzor, sock) ) {
+            close(sock);
+            break;
+        }
+        close(sock);
+    }
+    close(lsock);
+
+    return 0;
+}
+
@@ -0,0 +1,18 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef DISTRIBUTORH
+#define DISTRIBUTORH
+
+#include "mandelbrot_set.h"
+
+#define EDS_MAX_TILE	4096	/* largest side of a tile a worker renders */
+
+extern int coordinator(const fdata*);
+extern int serve(const fdata*, const char* hostport);
+
+#endif
@@ -0,0 +1,486 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Wzory fraktali
+ * Fractal formulas
+ *
+ * A formula is a policy of two functions working on the real and
+ * imaginary parts separately:
+ *	start(p)	Z1 and c of the point p of the picture
+ *	step(Z, c)	Zn = f(Z(n-1)) + c
+ * The kernel is a template instantiated for every formula, so each one
+ * gets a loop of its own without any call per iteration. The parts are
+ * of any type V with double arithmetic, a double or a SIMD vector.
+ *
+ * Rows and boxes are rendered by one of the kernels of fdata.kernel:
+ *	simd		fractal_points_simd, SIMD_LANES points in vectors,
+ *			a lane whose point is done takes the next one at once
+ *	interleaved	fractal_points_il, IL_ORBITS scalar orbits at once: one
+ *			orbit is a chain of dependent multiplications, several
+ *			independent ones keep the CPU's pipelines full
+ *	point		fractal_point, a pixel after a pixel
+ * The first one is the default where the target has vector registers,
+ * the second one elsewhere. Their results are those of fractal_point,
+ * bit for bit.
+ */
+
+#ifndef FORMULAH
+#define FORMULAH
+
+#include <complex>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+#include "mandelbrot_set.h"
+
+/* fdata.formula */
+enum { F_MANDELBROT = 0, F_JULIA, F_MULTIBROT, F_BURNING_SHIP };
+
+#define MULTIBROT_MAX	8	/* highest power d of z^d + c */
+
+#define IL_ORBITS	8	/* orbits advanced together by fractal_points_il */
+#define IL_EPS		1e-12	/* |Z|^2 this close to T^2 is decided by hypot */
+
+/* doubles in a vector register: GCC splits wider vectors and keeps them in memory */
+#ifdef __AVX__
+#define SIMD_WIDTH	4
+#else
+#define SIMD_WIDTH	2
+#endif
+#define SIMD_VECS	2	/* vectors of fractal_points_simd, independent chains as in fractal_points_il */
+#define SIMD_LANES	(SIMD_WIDTH * SIMD_VECS)
+
+typedef double vdouble __attribute__((vector_size(SIMD_WIDTH * sizeof(double))));
+typedef long long vlong __attribute__((vector_size(SIMD_WIDTH * sizeof(long long))));
+
+/* whether vdouble lives in vector registers; GCC emulates it with scalars elsewhere */
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ALTIVEC__)
+#define SIMD_NATIVE	1
+#else
+#define SIMD_NATIVE	0
+#endif
+
+/* fdata.kernel */
+enum { K_SIMD = 0, K_INTERLEAVED, K_POINT };
+
+#define K_DEFAULT	( SIMD_NATIVE ? K_SIMD : K_INTERLEAVED )
+
+///////////////////////////////////////
+
+/* |x| of a double and of every lane of a vector */
+static inline double
+vabs(double x)
+{
+    return fabs(x);
+}
+
+static inline vdouble
+vabs(vdouble x)
+{
+    return (vdouble)((vlong)x & 0x7fffffffffffffffLL);
+}
+
+///////////////////////////////////////
+
+/* Z0 = 0, Zn = Z(n-1)^2 + c */
+struct Mandelbrot {
+    template<class V> static inline void
+    start(V px, V py, V& zx, V& zy, V& cx, V& cy, const fdata*)
+    {
+        zx = cx = px;
+        zy = cy = py;
+    }
+
+    template<class V> static inline void
+    step(V& zx, V& zy, V cx, V cy)
+    {
+        /* the same operations as complex<double> Zn * Zn + c */
+        V t = zx * zx - zy * zy + cx;
+        zy = zx * zy + zy * zx + cy;
+        zx = t;
+    }
+};
+
+/* Z1 = p, Zn = Z(n-1)^2 + c for c fixed by the command line */
+struct Julia {
+    template<class V> static inline void
+    start(V px, V py, V& zx, V& zy, V& cx, V& cy, const fdata* fd)
+    {
+        zx = px;
+        zy = py;
+        cx = fd->jre;
+        cy = fd->jim;
+    }
+
+    template<class V> static inline void
+    step(V& zx, V& zy, V cx, V cy)
+    {
+        Mandelbrot::step(zx, zy, cx, cy);
+    }
+};
+
+/* Z0 = 0, Zn = Z(n-1)^D + c */
+template<int D>
+struct Multibrot {
+    template<class V> static inline void
+    start(V px, V py, V& zx, V& zy, V& cx, V& cy, const fdata* fd)
+    {
+        Mandelbrot::start(px, py, zx, zy, cx, cy, fd);
+    }
+
+    template<class V> static inline void
+    step(V& zx, V& zy, V cx, V cy)
+    {
+        V rx = zx, ry = zy, t;
+        int i;
+
+        /* D is known at compile time, so this unrolls */
+        for ( i = 1; i < D; i++ ) {
+            t = rx * zx - ry * zy;
+            ry = rx * zy + ry * zx;
+            rx = t;
+        }
+        zx = rx + cx;
+        zy = ry + cy;
+    }
+};
+
+/* Z0 = 0, Zn = (|Re Z(n-1)| + i|Im Z(n-1)|)^2 + c */
+struct BurningShip {
+    template<class V> static inline void
+    start(V px, V py, V& zx, V& zy, V& cx, V& cy, const fdata* fd)
+    {
+        Mandelbrot::start(px, py, zx, zy, cx, cy, fd);
+    }
+
+    template<class V> static inline void
+    step(V& zx, V& zy, V cx, V cy)
+    {
+        V ax = vabs(zx), ay = vabs(zy);
+        V t = ax * ax - ay * ay + cx;
+        zy = ax * ay + ay * ax + cy;
+        zx = t;
+    }
+};
+
+///////////////////////////////////////
+
+template<class F>
+static inline int
+fractal_point_f(std::complex<double> p, const fdata* fd)
+    /* oblicza jak szybko ucieka punkt o wspolrzednych zespolonych */
+    /* counts how fast the point described with complex coordinates is moving from its origins */
+{
+    double zx, zy, cx, cy;
+    double T = fd->T;
+    int n, limit = fd->maxiter+1;
+
+    /* hypot is what abs(complex<double>) computes */
+    if ( hypot(p.real(), p.imag()) >= T ) //point is already over the range
+        return 0;
+
+    F::start(p.real(), p.imag(), zx, zy, cx, cy, fd);
+    for ( n=1;  // we start with 1 because point is not over the range on the very beginning
+            hypot(zx, zy) < T && n < limit;
+            n++ )
+        F::step(zx, zy, cx, cy);
+
+    return n-1; //due to the last incrementation in the FOR loop
+}
+
+///////////////////////////////////////
+
+static inline int
+fractal_point(std::complex<double> c, const fdata* fd)
+    /* the formula is chosen once per point, not per iteration */
+{
+    switch ( fd->formula ) {
+        case F_JULIA:
+            return fractal_point_f<Julia>(c, fd);
+        case F_BURNING_SHIP:
+            return fractal_point_f<BurningShip>(c, fd);
+        case F_MULTIBROT:
+            switch ( fd->power ) {
+                case 3: return fractal_point_f< Multibrot<3> >(c, fd);
+                case 4: return fractal_point_f< Multibrot<4> >(c, fd);
+                case 5: return fractal_point_f< Multibrot<5> >(c, fd);
+                case 6: return fractal_point_f< Multibrot<6> >(c, fd);
+                case 7: return fractal_point_f< Multibrot<7> >(c, fd);
+                case 8: return fractal_point_f< Multibrot<8> >(c, fd);
+                default: return fractal_point_f<Mandelbrot>(c, fd);
+            }
+        default:
+            return fractal_point_f<Mandelbrot>(c, fd);
+    }
+}
+
+///////////////////////////////////////
+
+static inline int
+pixel_point(const fdata* d, int xl, int yl)
+    /* escape time of the middle of pixel (xl, yl) */
+{
+    /* dodajemy jeszcze pol roznicy bo chcemy liczyc od srodka pierwszego pola */
+    /* adding half of the field size because we want to count beggining with the middle of the first field */
+    std::complex<double> c(d->xmin+(d->xo+xl+0.5)*d->xdiff, d->ymin+(d->yo+yl+0.5)*d->ydiff);
+
+    return fractal_point(c, d);
+}
+
+///////////////////////////////////////
+
+static inline int
+escaped(double zx, double zy, double lo, double hi, double T)
+    /* ! (hypot(zx, zy) < T), with the square alone wherever its rounding cannot change the answer */
+{
+    double r2 = zx * zx + zy * zy;
+
+    if ( r2 < lo )
+        return 0;
+    if ( r2 > hi )
+        return 1;
+    return ! (hypot(zx, zy) < T);
+}
+
+///////////////////////////////////////
+
+/* pixels [xl, ...) of row yl, c computed as in pixel_point */
+struct RowPoints {
+    const fdata* d;
+    int xl;
+    double py;
+
+    RowPoints(const fdata* fd, int x, int yl)
+        : d(fd), xl(x), py(fd->ymin+(fd->yo+yl+0.5)*fd->ydiff) {}
+
+    inline void
+    at(int i, double& px, double& y) const
+    {
+        px = d->xmin+(d->xo+(xl+i)+0.5)*d->xdiff;
+        y = py;
+    }
+};
+
+///////////////////////////////////////
+
+template<class F, class P, class O>
+static inline void
+fractal_points_il(const fdata* fd, const P& src, int count, O* out)
+    /*
+     * escape times of count points of src, IL_ORBITS of them in lockstep;
+     * a slot whose orbit has escaped (or run out of iterations) takes the
+     * next point, so the slots stay busy until the points run out
+     */
+{
+    double zx[IL_ORBITS], zy[IL_ORBITS], cx[IL_ORBITS], cy[IL_ORBITS];
+    int n[IL_ORBITS];	/* n of the loop of fractal_point_f */
+    int at[IL_ORBITS];	/* point of the slot, -1 - none */
+    double T = fd->T, lo = T * T * (1 - IL_EPS), hi = T * T * (1 + IL_EPS);
+    int limit = fd->maxiter+1, next = 0, live = 0, k;
+    double px, py;
+
+    for ( k = 0; k < IL_ORBITS; k++ ) {
+        zx[k] = zy[k] = cx[k] = cy[k] = 0;
+        n[k] = 1;
+        at[k] = -1;
+    }
+
+    for (;;) {
+        for ( k = 0; k < IL_ORBITS; k++ )
+            while ( at[k] < 0 || n[k] >= limit || escaped(zx[k], zy[k], lo, hi, T) ) {
+                if ( at[k] >= 0 ) {
+                    out[at[k]] = n[k]-1;
+                    at[k] = -1;
+                    live--;
+                }
+                /* an empty slot iterates 0, which stays 0 */
+                if ( next >= count ) {
+                    zx[k] = zy[k] = cx[k] = cy[k] = 0;
+                    break;
+                }
+                /* Z1 is the point itself for every formula, so its check is the one of |p| >= T */
+                src.at(next, px, py);
+                F::start(px, py, zx[k], zy[k], cx[k], cy[k], fd);
+                n[k] = 1;
+                at[k] = next++;
+                live++;
+            }
+        if ( live == 0 )
+            break;
+
+        for ( k = 0; k < IL_ORBITS; k++ )
+            F::step(zx[k], zy[k], cx[k], cy[k]);
+        for ( k = 0; k < IL_ORBITS; k++ )
+            n[k]++;
+    }
+}
+
+///////////////////////////////////////
+
+template<class F, class P, class O>
+static inline void
+fractal_points_simd(const fdata* fd, const P& src, int count, O* out, long long* lanestat)
+    /*
+     * escape times of count points of src, SIMD_LANES of them in SIMD_VECS vectors;
+     * a lane whose orbit has escaped (or run out of iterations) is reloaded
+     * with the next point right away instead of idling until the slowest
+     * lane is done; lanestat, unless NULL, gets the busy and all
+     * lane-iterations added
+     */
+{
+    /* lanes are loaded one by one in arrays, the vectors only iterate them */
+    double zx[SIMD_LANES], zy[SIMD_LANES], cx[SIMD_LANES], cy[SIMD_LANES];
+    long long n[SIMD_LANES];	/* n of the loop of fractal_point_f */
+    int at[SIMD_LANES];	/* point of the lane, -1 - none */
+    vdouble vzx[SIMD_VECS], vzy[SIMD_VECS], vcx[SIMD_VECS], vcy[SIMD_VECS], r2, vn[SIMD_VECS], vlo, vlimit;
+    vlong check;
+    int j;
+    double T = fd->T, lo = T * T * (1 - IL_EPS), hi = T * T * (1 + IL_EPS);
+    int limit = fd->maxiter+1, next = 0, live = 0, k, any;
+    long long busy = 0, rounds = 0, run;
+
+    for ( k = 0; k < SIMD_WIDTH; k++ ) {
+        vlo[k] = lo;
+        vlimit[k] = limit;
+    }
+    for ( k = 0; k < SIMD_LANES; k++ )
+        at[k] = -1;
+
+    for (;;) {
+        for ( k = 0; k < SIMD_LANES; k++ )
+            while ( at[k] < 0 || n[k] >= limit || escaped(zx[k], zy[k], lo, hi, T) ) {
+                if ( at[k] >= 0 ) {
+                    out[at[k]] = n[k]-1;
+                    at[k] = -1;
+                    live--;
+                }
+                /* an empty lane iterates 0, which stays 0, and never runs out of iterations */
+                if ( next >= count ) {
+                    zx[k] = zy[k] = cx[k] = cy[k] = 0;
+                    n[k] = -(1LL << 62);
+                    break;
+                }
+                src.at(next, zx[k], zy[k]);
+                F::start(zx[k], zy[k], zx[k], zy[k], cx[k], cy[k], fd);
+                n[k] = 1;
+                at[k] = next++;
+                live++;
+            }
+        if ( live == 0 )
+            break;
+
+        /* iterate until a lane may be done: near or over T, or out of iterations */
+        memcpy(vzx, zx, sizeof(vzx));
+        memcpy(vzy, zy, sizeof(vzy));
+        memcpy(vcx, cx, sizeof(vcx));
+        memcpy(vcy, cy, sizeof(vcy));
+        for ( k = 0; k < SIMD_LANES; k++ )
+            vn[k / SIMD_WIDTH][k % SIMD_WIDTH] = n[k];
+        run = 0;
+        do {
+            for ( j = 0; j < SIMD_VECS; j++ ) {
+                F::step(vzx[j], vzy[j], vcx[j], vcy[j]);
+                vn[j] += 1;
+            }
+            run++;
+            check = (vlong){};
+            for ( j = 0; j < SIMD_VECS; j++ ) {
+                r2 = vzx[j] * vzx[j] + vzy[j] * vzy[j];
+                check |= (r2 >= vlo) | (vn[j] >= vlimit);
+            }
+            for ( any = 0, k = 0; k < SIMD_WIDTH; k++ )
+                any |= check[k] != 0;
+        } while ( ! any );
+        memcpy(zx, vzx, sizeof(vzx));
+        memcpy(zy, vzy, sizeof(vzy));
+        for ( k = 0; k < SIMD_LANES; k++ )
+            n[k] += run;
+        rounds += run;
+        busy += run * live;
+    }
+
+    if ( lanestat != NULL ) {
+        __atomic_fetch_add(&lanestat[0], busy, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&lanestat[1], rounds * SIMD_LANES, __ATOMIC_RELAXED);
+    }
+}
+
+///////////////////////////////////////
+
+template<class F, class O>
+static inline void
+render_points_f(const fdata* d, int yl, int xl, int xh, O* row)
+{
+    int x;
+
+    /* a threshold whose square does not fit in a double is left to hypot */
+    if ( d->kernel == K_POINT || ! (d->T * d->T * (1 + IL_EPS) <= DBL_MAX) )
+        for ( x = xl; x < xh; x++ )
+            row[x] = pixel_point(d, x, yl);
+    else if ( d->kernel == K_SIMD )
+        fractal_points_simd<F>(d, RowPoints(d, xl, yl), xh - xl, row + xl, d->lanes);
+    else
+        fractal_points_il<F>(d, RowPoints(d, xl, yl), xh - xl, row + xl);
+}
+
+template<class F>
+static inline void
+render_span_f(const fdata* d, int yl, int xl, int xh)
+{
+    char* row = d->tab[yl];
+    int x;
+
+    if ( d->counts == NULL ) {
+        render_points_f<F>(d, yl, xl, xh, row);
+        return;
+    }
+    /* the full counts first, tab gets them modulo 256 */
+    render_points_f<F>(d, yl, xl, xh, d->counts[yl]);
+    for ( x = xl; x < xh; x++ )
+        row[x] = d->counts[yl][x];
+}
+
+static inline void
+render_span(const fdata* d, int yl, int xl, int xh)
+    /* pixels [xl, xh) of row yl */
+{
+    switch ( d->formula ) {
+        case F_JULIA:
+            return render_span_f<Julia>(d, yl, xl, xh);
+        case F_BURNING_SHIP:
+            return render_span_f<BurningShip>(d, yl, xl, xh);
+        case F_MULTIBROT:
+            switch ( d->power ) {
+                case 3: return render_span_f< Multibrot<3> >(d, yl, xl, xh);
+                case 4: return render_span_f< Multibrot<4> >(d, yl, xl, xh);
+                case 5: return render_span_f< Multibrot<5> >(d, yl, xl, xh);
+                case 6: return render_span_f< Multibrot<6> >(d, yl, xl, xh);
+                case 7: return render_span_f< Multibrot<7> >(d, yl, xl, xh);
+                case 8: return render_span_f< Multibrot<8> >(d, yl, xl, xh);
+                default: return render_span_f<Mandelbrot>(d, yl, xl, xh);
+            }
+        default:
+            return render_span_f<Mandelbrot>(d, yl, xl, xh);
+    }
+}
+
+///////////////////////////////////////
+
+static inline void
+render_row(const fdata* d, int yl)
+    /* the kernel of every row-based backend: row yl, unless it is there already (e.g. resumed from a checkpoint) */
+    /* or the render has been cancelled */
+{
+    if ( row_is_done(d, yl) || cancelled(d) )
+        return;
+    render_span(d, yl, 0, d->resolution);
+    row_done(d, yl);
+}
+
+#endif
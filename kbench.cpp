@@ -0,0 +1,446 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Pomiar jadra
+ * Microbenchmark of the escape-time kernel
+ *
+ * One thread, pinned, runs every variant of the kernel over fixed sets of
+ * points, without any scheduler around it:
+ *	interior	points of the main cardioid, all of them reach maxiter
+ *	escape		points escaping within a few iterations
+ *	boundary	the seahorse valley, long and uneven orbits
+ *	mixed		the whole set, as the default picture
+ * and the variants:
+ *	complex		std::complex<double> and abs(), the kernel as it used to be
+ *	hypot		fractal_point, the kernel of the backends
+ *	norm2		|Z|^2 < T^2 instead of |Z| < T
+ *	specialized	norm2 with the squares kept for the next iteration
+ *	interior	specialized, the cardioid and the period-2 bulb are not iterated
+ *	simd		the Mandelbrot policy of formula.h on GCC vectors of SIMD_WIDTH
+ *	interleaved	fractal_points_il, IL_ORBITS scalar orbits in lockstep
+ *	refill		fractal_points_simd, a lane takes the next point as soon
+ *			as its own is done
+ *
+ * After a warmup every variant is timed -r times. The output is CSV: ns
+ * per iteration (of the iterations fractal_point needs, so the variants
+ * skipping work look faster), ns per pixel, the share of busy SIMD lanes
+ * and the pixels whose count differs from fractal_point.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mandelbrot_set.h"
+#include "formula.h"
+#include "affinity.h"
+
+#define KB_MAXREPS	101
+
+typedef struct {
+    const char* name;
+    int n;
+    double *x, *y;
+    long long iters;	/* iterations fractal_point needs for the whole set */
+    int* counts;		/* its counts, the reference of the variants */
+} pointset;
+
+typedef struct {
+    const char* name;
+    /* counts of the n points into out; returns busy and all lane-iterations for SIMD, 0 otherwise */
+    void (*run)(const fdata*, const pointset*, int* out, long long* busy, long long* lanes);
+} variant;
+
+///////////////////////////////////////
+
+static uint64_t
+splitmix64(uint64_t* s)
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double
+uniform(uint64_t* s)
+{
+    return (splitmix64(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+///////////////////////////////////////
+
+static void
+kernel_complex(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    int i, n;
+
+    for ( i = 0; i < p->n; i++ ) {
+        std::complex<double> c(p->x[i], p->y[i]), z = c;
+
+        if ( abs(c) >= fd->T ) {
+            out[i] = 0;
+            continue;
+        }
+        for ( n = 1; abs(z) < fd->T && n < fd->maxiter+1; n++ )
+            z = z * z + c;
+        out[i] = n-1;
+    }
+}
+
+///////////////////////////////////////
+
+static void
+kernel_hypot(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    int i;
+
+    for ( i = 0; i < p->n; i++ )
+        out[i] = fractal_point(std::complex<double>(p->x[i], p->y[i]), fd);
+}
+
+///////////////////////////////////////
+
+static void
+kernel_norm2(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    double T2 = fd->T * fd->T, zx, zy, cx, cy;
+    int i, n;
+
+    for ( i = 0; i < p->n; i++ ) {
+        cx = zx = p->x[i];
+        cy = zy = p->y[i];
+        if ( zx * zx + zy * zy >= T2 ) {
+            out[i] = 0;
+            continue;
+        }
+        for ( n = 1; zx * zx + zy * zy < T2 && n < fd->maxiter+1; n++ )
+            Mandelbrot::step(zx, zy, cx, cy);
+        out[i] = n-1;
+    }
+}
+
+///////////////////////////////////////
+
+static inline int
+specialized_point(double cx, double cy, double T2, int maxiter)
+{
+    double zx = cx, zy = cy, x2 = cx * cx, y2 = cy * cy;
+    int n;
+
+    if ( x2 + y2 >= T2 )
+        return 0;
+    for ( n = 1; x2 + y2 < T2 && n < maxiter+1; n++ ) {
+        zy = 2 * zx * zy + cy;
+        zx = x2 - y2 + cx;
+        x2 = zx * zx;
+        y2 = zy * zy;
+    }
+    return n-1;
+}
+
+static void
+kernel_specialized(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    double T2 = fd->T * fd->T;
+    int i;
+
+    for ( i = 0; i < p->n; i++ )
+        out[i] = specialized_point(p->x[i], p->y[i], T2, fd->maxiter);
+}
+
+///////////////////////////////////////
+
+static void
+kernel_interior(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    double T2 = fd->T * fd->T, x, y, q;
+    int i;
+
+    for ( i = 0; i < p->n; i++ ) {
+        x = p->x[i];
+        y = p->y[i];
+        q = (x - 0.25) * (x - 0.25) + y * y;
+        /* the main cardioid and the period-2 bulb never escape */
+        if ( q * (q + (x - 0.25)) <= 0.25 * y * y || (x + 1) * (x + 1) + y * y <= 0.0625 )
+            out[i] = ( x * x + y * y < T2 ) ? fd->maxiter : 0;
+        else
+            out[i] = specialized_point(x, y, T2, fd->maxiter);
+    }
+}
+
+///////////////////////////////////////
+
+static void
+kernel_simd(const fdata* fd, const pointset* p, int* out, long long* busy, long long* lanes)
+{
+    vdouble T2 = {}, zx, zy, cx = {}, cy = {};
+    vlong count = {}, active;
+    int i, k, n, any;
+
+    for ( k = 0; k < SIMD_WIDTH; k++ )
+        T2[k] = fd->T * fd->T;
+
+    for ( i = 0; i < p->n; i += SIMD_WIDTH ) {
+        for ( k = 0; k < SIMD_WIDTH; k++ ) {
+            /* the tail is padded with a point which escapes at once */
+            cx[k] = ( i + k < p->n ) ? p->x[i + k] : 4;
+            cy[k] = ( i + k < p->n ) ? p->y[i + k] : 4;
+            count[k] = 0;
+        }
+        zx = cx;
+        zy = cy;
+        active = (zx * zx + zy * zy < T2);
+
+        for ( n = 0; n < fd->maxiter; n++ ) {
+            for ( any = 0, k = 0; k < SIMD_WIDTH; k++ )
+                any |= active[k] != 0;
+            if ( ! any )
+                break;
+            for ( k = 0; k < SIMD_WIDTH; k++ )
+                *busy += active[k] != 0;
+            *lanes += SIMD_WIDTH;
+
+            Mandelbrot::step(zx, zy, cx, cy);
+            count -= active;	/* a true lane is -1 */
+            active &= (zx * zx + zy * zy < T2);
+        }
+
+        for ( k = 0; k < SIMD_WIDTH && i + k < p->n; k++ )
+            out[i + k] = (int)count[k];
+    }
+}
+
+///////////////////////////////////////
+
+/* points of a set for fractal_points_il */
+struct SetPoints {
+    const pointset* p;
+
+    SetPoints(const pointset* ps) : p(ps) {}
+
+    inline void
+    at(int i, double& x, double& y) const
+    {
+        x = p->x[i];
+        y = p->y[i];
+    }
+};
+
+static void
+kernel_interleaved(const fdata* fd, const pointset* p, int* out, long long*, long long*)
+{
+    fractal_points_il<Mandelbrot>(fd, SetPoints(p), p->n, out);
+}
+
+static void
+kernel_refill(const fdata* fd, const pointset* p, int* out, long long* busy, long long* lanes)
+{
+    long long stat[2] = { 0, 0 };
+
+    fractal_points_simd<Mandelbrot>(fd, SetPoints(p), p->n, out, stat);
+    *busy += stat[0];
+    *lanes += stat[1];
+}
+
+///////////////////////////////////////
+
+static const variant variants[] = {
+    { "complex",		kernel_complex },
+    { "hypot",		kernel_hypot },
+    { "norm2",		kernel_norm2 },
+    { "specialized",	kernel_specialized },
+    { "interior",		kernel_interior },
+    { "simd",		kernel_simd },
+    { "interleaved",	kernel_interleaved },
+    { "refill",		kernel_refill },
+};
+
+#define NVARIANTS	(int)(sizeof(variants) / sizeof(variants[0]))
+
+///////////////////////////////////////
+
+static void
+make_set(pointset* p, const char* name, int n, const fdata* fd)
+    /* the same points on every run: the seed is fixed */
+{
+    uint64_t seed = 0x45445321;	/* "EDS!" */
+    double r, a;
+    int i;
+
+    p->name = name;
+    p->n = n;
+    p->x = (double*)malloc(n * sizeof(double));
+    p->y = (double*)malloc(n * sizeof(double));
+    p->counts = (int*)malloc(n * sizeof(int));
+
+    for ( i = 0; i < n; i++ ) {
+        if ( ! strcmp(name, "interior") ) {
+            /* the disc |c| < 1/4 lies in the main cardioid */
+            r = 0.24 * sqrt(uniform(&seed));
+            a = 2 * M_PI * uniform(&seed);
+            p->x[i] = r * cos(a);
+            p->y[i] = r * sin(a);
+        } else if ( ! strcmp(name, "escape") ) {
+            r = 1.6 + 0.35 * uniform(&seed);
+            a = 2 * M_PI * uniform(&seed);
+            p->x[i] = r * cos(a);
+            p->y[i] = r * sin(a);
+        } else if ( ! strcmp(name, "boundary") ) {
+            p->x[i] = -0.80 + 0.10 * uniform(&seed);
+            p->y[i] = 0.05 + 0.10 * uniform(&seed);
+        } else {
+            p->x[i] = -2 + 4 * uniform(&seed);
+            p->y[i] = -2 + 4 * uniform(&seed);
+        }
+    }
+
+    kernel_hypot(fd, p, p->counts, NULL, NULL);
+    for ( p->iters = 0, i = 0; i < n; i++ )
+        p->iters += p->counts[i];
+}
+
+///////////////////////////////////////
+
+static double
+now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+by_value(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return ( x > y ) - ( x < y );
+}
+
+///////////////////////////////////////
+
+static int
+usage(char* appName)
+{
+    printf("Usage: %s [options]\n", appName);
+    printf("-i\t\tMaximal number of iterations [default: 1000]\n");
+    printf("-t\t\tThreshold [default: 2]\n");
+    printf("-p\t\tPoints in every set [default: 4096]\n");
+    printf("-r\t\tTimed repetitions of every variant (at most %d) [default: 7]\n", KB_MAXREPS);
+    printf("-A\t\tCPU to run on: compact, scatter or a CPU list [default: compact]\n");
+    printf("-h\t\tPrints this help\n");
+
+    return 0;
+}
+
+///////////////////////////////////////
+///////////////////////////////////////
+
+int
+main(int argc, char* argv[])
+{
+    static const char* sets[] = { "interior", "escape", "boundary", "mixed" };
+    double t[KB_MAXREPS], t0;
+    const char* cpu = "compact";
+    int npoints = 4096, reps = 7, s, v, r, i, c, wrong;
+    long long busy, lanes, sink = 0;
+    pointset p;
+    fdata fd;
+    int* out;
+
+    memset(&fd, 0, sizeof(fd));
+    fd.maxiter = 1000;
+    fd.T = 2;
+    fd.formula = F_MANDELBROT;
+
+    while ( (c = getopt(argc, argv, "i:t:p:r:A:h")) != -1 )
+        switch ( c ) {
+            case 'i':
+                fd.maxiter = atoi(optarg);
+                break;
+            case 't':
+                fd.T = atof(optarg);
+                break;
+            case 'p':
+                npoints = atoi(optarg);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'A':
+                cpu = optarg;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    if ( fd.maxiter < 1 || fd.T <= 0 || npoints < 1 || reps < 1 || reps > KB_MAXREPS ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* one thread on one CPU, so nothing but the kernel is measured */
+    if ( affinity_init(cpu, 1) == 0 )
+        affinity_pin(0);
+
+    out = (int*)malloc(npoints * sizeof(int));
+    printf("# maxiter %d, threshold %g, %d points, %d repetitions, %d SIMD lanes\n",
+            fd.maxiter, fd.T, npoints, reps, SIMD_LANES);
+    printf("variant,set,pixels,iterations,ns_per_iter_median,ns_per_iter_min,ns_per_iter_stddev,ns_per_pixel_median,lane_utilization,mismatches\n");
+
+    for ( s = 0; s < 4; s++ ) {
+        make_set(&p, sets[s], npoints, &fd);
+
+        for ( v = 0; v < NVARIANTS; v++ ) {
+            double mean = 0, dev = 0, med;
+
+            /* warmup: caches, branch predictors and the CPU's clock */
+            busy = lanes = 0;
+            variants[v].run(&fd, &p, out, &busy, &lanes);
+            for ( wrong = 0, i = 0; i < p.n; i++ )
+                wrong += out[i] != p.counts[i];
+
+            for ( r = 0; r < reps; r++ ) {
+                t0 = now_ns();
+                variants[v].run(&fd, &p, out, &busy, &lanes);
+                t[r] = now_ns() - t0;
+                sink += out[r % p.n];
+            }
+            for ( r = 0; r < reps; r++ )
+                mean += t[r] / reps;
+            for ( r = 0; r < reps; r++ )
+                dev += (t[r] - mean) * (t[r] - mean) / reps;
+            qsort(t, reps, sizeof(double), by_value);
+            med = t[reps / 2];
+
+            printf("%s,%s,%d,%lld,%.4f,%.4f,%.4f,%.2f,%.4f,%d\n", variants[v].name, p.name, p.n, p.iters,
+                    med / (p.iters ? p.iters : 1), t[0] / (p.iters ? p.iters : 1),
+                    sqrt(dev) / (p.iters ? p.iters : 1), med / p.n,
+                    lanes ? (double)busy / lanes : 1.0, wrong);
+            fflush(stdout);
+        }
+
+        free(p.x);
+        free(p.y);
+        free(p.counts);
+    }
+
+    free(out);
+    /* keeps the results alive for the compiler */
+    return sink == 42 ? 2 : 0;
+}
@@ -12,11 +12,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <climits>
+#include <sched.h>
 
 #include "mandelbrot_set.h"
-#include "mandelbrot_set_omp.h"
-#include "mandelbrot_set_sq.h"
 #include "manager.h"
+#include "backend.h"
+#include "distributor.h"
+#include "affinity.h"
 #include "worker.h"
 
 /*
@@ -24,19 +27,22 @@
  *
  */
 
-int freeProc = -1;	/* threads are numbered from 0 on, -1 means invalid or none */
-int frees = 0;		/* the number of workers waiting for a job */
-int boxing = -1;		/* number of thread currently splitting its box */
+mgroup mgr = {
+    -1,				/* freeProc */
+    0,				/* frees */
+    PTHREAD_COND_INITIALIZER,	/* worker wakes up manager */
+    PTHREAD_COND_INITIALIZER,	/* manager can serve calling thread */
+    PTHREAD_COND_INITIALIZER,	/* manager has finished working on current thread */
+    PTHREAD_MUTEX_INITIALIZER,	/* one needs manager */
+    PTHREAD_MUTEX_INITIALIZER,	/* being locked by a worker when it finishes its job */
+    NULL, 0
+};
 
-pthread_cond_t cond   = PTHREAD_COND_INITIALIZER;	/* worker wakes up manager */
-pthread_cond_t mfree  = PTHREAD_COND_INITIALIZER;	/* manager can serve calling thread */
-pthread_cond_t mdone  = PTHREAD_COND_INITIALIZER;	/* manager has finished working on current thread */
+int boxing = -1;		/* number of thread currently splitting its box */
 pthread_cond_t newBox = PTHREAD_COND_INITIALIZER;	/* new box is going to be processed */
-
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;	/* one needs manager */
-pthread_mutex_t muti  = PTHREAD_MUTEX_INITIALIZER;	/* being locked by a worker when it finishes its job */
 pthread_mutex_t sharingBox = PTHREAD_MUTEX_INITIALIZER;	/* for sharing a job in MagicBox */
 
+static pthread_mutex_t top = PTHREAD_MUTEX_INITIALIZER;	/* top-level manager; groups borrow work from each other */
 
 /*
  * Functions' definitions
@@ -44,41 +50,27 @@ pthread_mutex_t sharingBox = PTHREAD_MUTEX_INITIALIZER;	/* for sharing a job in
  */
 
 static int
-copy_fd(const fdata* fd1, fdata* fd2)
-{
-#ifdef DEBUG
-    printf("\t[Manager]->copy_fd\n");
-#endif
-    memcpy(fd2, fd1, sizeof(fdata));
-
-    return 0;
-}
-
-////////////////////////////////////////
-
-static int
-init_raport(fdata* raport, const fdata* wzor, int numer_procesu, pthread_mutex_t* mutt)
+init_raport(wdata* raport, const fdata* wzor, int numer_procesu)
 {
     int dy;	/* delta y */
+    int yl, yh;
 
 #ifdef DEBUG
     printf("\t[Manager]->init_raport: %d\n", numer_procesu);
 #endif
 
-    copy_fd(wzor, raport);
+    raport->fd = wzor;
 
     dy = (int) floor(wzor->resolution/wzor->num_proc);
-    raport->yl = 0 + numer_procesu * dy;
+    yl = 0 + numer_procesu * dy;
     if ( wzor->num_proc == (numer_procesu + 1) )
-        raport->yh = wzor->resolution; // because numeration begins with 0
+        yh = wzor->resolution; // because numeration begins with 0
     else
-        raport->yh = 0 + (numer_procesu + 1) * dy;
-
-    raport->xl = 0;
-    raport->xh = wzor->resolution;
+        yh = 0 + (numer_procesu + 1) * dy;
+    raport->rows = ROWS(yl, yh);
 
     raport->wID = numer_procesu;
-    raport->mutt = mutt;
+    pthread_mutex_init(&raport->mutt, NULL);
     raport->status = 1;	// on the beggining we will have job to do
 
     return 0;
@@ -87,14 +79,14 @@ init_raport(fdata* raport, const fdata* wzor, int numer_procesu, pthread_mutex_t
 ////////////////////////////////////////
 
 static int
-init_raport_mb(fdata* raport, const fdata* wzor, int numer_procesu, pthread_mutex_t* mutt)
+init_raport_mb(wdata* raport, const fdata* wzor, int numer_procesu)
 {
 
 #ifdef DEBUG
     printf("\t[Manager]->init_raport_mb: %d\n", numer_procesu);
 #endif
 
-    copy_fd(wzor, raport);
+    raport->fd = wzor;
 
     raport->bl = 0 ;
     if ( numer_procesu == 0 )
@@ -108,19 +100,51 @@ init_raport_mb(fdata* raport, const fdata* wzor, int numer_procesu, pthread_mute
         raport->status = 0;
     }
     raport->wID = numer_procesu;
-    raport->mutt = mutt;
+    pthread_mutex_init(&raport->mutt, NULL);
 
     return 0;
 }
 
+static int
+split_rows(wdata* busy, wdata* idle)
+    /*
+     * gives the idle worker the latter half of the busy one's rows, 1 if there is nothing to share;
+     * the busy worker is locked but keeps counting without the lock, so its rows are split atomically
+     *
+     *	job1 = [yl, yl + (yh - yl)/2)	//stopped
+     *	job2 = [yl + (yh - yl)/2, yh)	//finished
+     */
+{
+    uint64_t r = __atomic_load_n(&busy->rows, __ATOMIC_ACQUIRE);
+    int yl, yh;
+
+    do {
+        yl = ROWS_LO(r);
+        yh = ROWS_HI(r);
+        if ( yh - yl <= 1 )
+            return 1;
+    } while ( ! __atomic_compare_exchange_n(&busy->rows, &r, ROWS(yl, yl + (yh - yl) / 2), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) );
+
+#ifdef DEBUG
+    printf("\t\t\t[Manager]->Splitting rows of #%d [yl: %d, yh: %d] with #%d\n", busy->wID, yl, yh, idle->wID);
+#endif
+    __atomic_store_n(&idle->rows, ROWS(yl + (yh - yl) / 2, yh), __ATOMIC_RELEASE);
+    idle->status = 1;
+
+    return 0;
+}
+
+////////////////////////////////////////
+
 /*
  * Function responsible for assigning work
  * When a thread appears with a request, it's managed here
  */
 static int
-manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_proc)
+manage(mgroup* g, wdata* raporty, pthread_mutex_t** mutexy, int num_proc, const int* order)
+    /* order[w * num_proc + k] - k-th thread asked for work when w is free (see affinity_scan_order) */
 {
-    int i;
+    int i, k;
     int nrProc = num_proc;	/* how many threads exist */
 
 #ifdef DEBUG
@@ -137,15 +161,15 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
 #endif
         /* zwalnia mutex a zaraz po obudzeniu zajmuje go ponownie */
         /* releases a mutex and just after waking up, aquires and locks it again */
-        pthread_cond_wait(&cond, &mutex);
+        pthread_cond_wait(&g->cond, &g->mutex);
 
 #ifdef DEBUG
-        printf("\t\t[Manager]->MANAGER AWAKENED by worker-%d!!!\n", freeProc);
+        printf("\t\t[Manager]->MANAGER AWAKENED by worker-%d!!!\n", g->freeProc);
 #endif
 
         /* blokujemy mutex wolnego procesu by miec dostep do jego danych i kontrole nad jego startem */
         /* blocking mutex of the free thread to gain exclusive access to its data and to have a control over its start */
-        if ( pthread_mutex_lock(mutexy[freeProc]))
+        if ( pthread_mutex_lock(mutexy[g->freeProc]))
             perror("Manager zaraz po obudzeniu\n");
 #ifdef DEBUG
         else
@@ -153,23 +177,24 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
 #endif
 
 
-        pthread_mutex_lock(&muti);
+        pthread_mutex_lock(&g->muti);
 
         /*
          * Blokujemy drugi watek
          * Blocking another thread
          */
-        i = freeProc;
-        frees = 1; /* on the beggining we know about only one free thread - the calling one */
+        k = 0;
+        g->frees = 1; /* on the beggining we know about only one free thread - the calling one */
         while (1) {
 #ifdef DEBUG
-            printf("\t\t[Manager]->Looking for a busy thread: nrProc=%d, frees=%d\n", nrProc, frees);
+            printf("\t\t[Manager]->Looking for a busy thread: nrProc=%d, frees=%d\n", nrProc, g->frees);
 #endif
-            i = (++i) % num_proc; // looking for another thread
+            /* looking for another thread, the ones on our socket first */
+            i = ( ++k < num_proc ) ? order[g->freeProc * num_proc + k] : g->freeProc;
 
             /* nie chcemy zajac samych siebie a przelecielismy juz wszystkie inne */
             /* we don't want to lock ourself and we have tried all others */
-            if ( i == freeProc ) {
+            if ( i == g->freeProc ) {
                 /* skoro przeszukalismy wszystkie i nie znalezlismy zadnego zajetego to pora konczyc */
                 /* niektore moga czekac jeszcze na zmiennej warunkowej lub liczyc ostatnia linie */
 
@@ -178,15 +203,15 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
 #ifdef DEBUG
                 printf("\t\t\t[Manager]->Finishing thread #%d\n", i);
 #endif
-                raporty[freeProc]->status = 2;
+                raporty[g->freeProc].status = 2;
                 nrProc--;
 
-                pthread_mutex_unlock(mutexy[freeProc]);
-                pthread_mutex_unlock(&muti);
-                pthread_cond_signal(&mdone);
+                pthread_mutex_unlock(mutexy[g->freeProc]);
+                pthread_mutex_unlock(&g->muti);
+                pthread_cond_signal(&g->mdone);
 
-                freeProc = -1;
-                pthread_cond_signal(&mfree);
+                g->freeProc = -1;
+                pthread_cond_signal(&g->mfree);
                 break;
             }
 
@@ -198,45 +223,11 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
                  * if we managed to block it now we have to check
                  * if the thread is really busy
                  */
-                if ( raporty[i]->status == 1 ) {
-                    if ( raporty[i]->yh == (raporty[i]->yl + 1)) {
+                if ( raporty[i].status == 1 ) {
+                    if ( split_rows(&raporty[i], &raporty[g->freeProc]) ) {
                         pthread_mutex_unlock(mutexy[i]);
                         continue;
                     }
-#ifdef DEBUG
-                    printf("\t\t\t[Manager]->found a busy thread: i=%d [yl: %d, yh: %d]\n", i, raporty[i]->yl, raporty[i]->yh);
-#endif
-                    /*
-                     * Mamy zajety watek o numerze i
-                     * We have locked thread #i
-                     *			 
-                     * teraz rozdzielamy prace pomiedzy te watki w nastepujacy sposob:
-                     * now we're dividing work between locked threads as follows:
-                     *
-                     *	job2->yh = job1->yh
-                     *	job1->yh = job1->yl + (job1->yh - job1->yl)/2
-                     *	job2->yl = job1->yh
-                     *
-                     *	job2 = raporty[freeProc] //finished
-                     *	job1 = raporty[i]	//stopped
-                     */
-#ifdef DEBUG
-                    printf("\t\t\t[Manager]->Changing threads' raports.. freeProc=%d and i=%d\n", freeProc, i);
-#endif
-
-                    raporty[freeProc]->yh = raporty[i]->yh;
-                    raporty[i]->yh = raporty[i]->yl + (int)floor((raporty[i]->yh - raporty[i]->yl) / 2);
-                    raporty[freeProc]->yl = raporty[i]->yh;
-
-                    if ( raporty[freeProc]->yl < raporty[freeProc]->yh )
-                        raporty[freeProc]->status = 1;
-                    else
-                        raporty[freeProc]->status = 0;
-
-                    if ( raporty[i]->yl < raporty[i]->yh )
-                        raporty[i]->status = 1;
-                    else
-                        raporty[i]->status = 0;
 
 #ifdef DEBUG
                     printf("\t\t\t[Manager]->Unlocking threads..\n");
@@ -244,16 +235,16 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
                     /* Najpierw startujemy watek, ktory zaczyna od daleszej czesci */
                     /* First we are strarting a thread that beggins with latter part */
                     pthread_mutex_unlock(mutexy[i]);	
-                    pthread_mutex_unlock(mutexy[freeProc]);
-                    pthread_mutex_unlock(&muti);
-                    pthread_cond_signal(&mdone);
+                    pthread_mutex_unlock(mutexy[g->freeProc]);
+                    pthread_mutex_unlock(&g->muti);
+                    pthread_cond_signal(&g->mdone);
 
 #ifdef DEBUG
-                    printf("\t\t\t[Manager]->Unlocked mutexes on: %d and %d\n", freeProc, i);
+                    printf("\t\t\t[Manager]->Unlocked mutexes on: %d and %d\n", g->freeProc, i);
 #endif
 
-                    freeProc = -1;
-                    pthread_cond_signal(&mfree);
+                    g->freeProc = -1;
+                    pthread_cond_signal(&g->mfree);
                     break;
                 }
                 /*
@@ -263,13 +254,13 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
                  * the thread has been finished
                  * so we are doing another lap in the loop, this time not counting it in as a free thread
                  */
-                else if ( raporty[i]->status == 0 ) {
+                else if ( raporty[i].status == 0 ) {
                     /* zablokowany watek tez jest wolny wiec nie ma zadnej pracy zeby z nim dzielic */
                     /* the blocked thread is also free so there is no work those two can share */
-                    frees++;
+                    g->frees++;
                     pthread_mutex_unlock(mutexy[i]);
                 }
-                else if ( raporty[i]->status == 2 ) {
+                else if ( raporty[i].status == 2 ) {
                     pthread_mutex_unlock(mutexy[i]);
                 } //koniec sprawdzania watkow, the end of checking threads
             } // koniec if ktore sprawdza czy udalo sie zajac mutex, the end of the if checking if we managed to aquire the mutex
@@ -285,12 +276,12 @@ manage(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_pr
 //
 ///////////////////////////////////////
 static int
-manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num_proc)
+manage_mb(mgroup* g, wdata* raporty, pthread_mutex_t** mutexy, int num_proc)
 {
     int timeout = 1;	/* after timeout seconds of waiting for new box we finish any calling thread */
     int i, mstat;		/* iterator and mutexStat */
     int nrProc = num_proc;	/* how many threads exist */
-    int busy;		/* how many busy threads we have */
+    int busy;		/* how many other threads are computing boxes */
     struct timespec ts;	/* for pthread_cond_timedwait */
 
 #ifdef DEBUG
@@ -307,9 +298,9 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
 #endif
         /* zwalnia mutex a zaraz po obudzeniu zajmuje go ponownie */
         /* releases a mutex and just after waking up, aquires and locks it again */
-        pthread_cond_wait(&cond, &mutex);
+        pthread_cond_wait(&g->cond, &g->mutex);
 #ifdef DEBUG
-        printf("\t\t[Manager]->MANAGER AWAKENED by worker-%d!!!\n", freeProc);
+        printf("\t\t[Manager]->MANAGER AWAKENED by worker-%d!!!\n", g->freeProc);
 #endif
 
         /* czekamy az mutex muti sie zwolni co bedzie znaczylo, ze watek
@@ -318,11 +309,11 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
          * waiting for muti mutex being released what means that the calling thread having it before
          * is ready for getting mdone message
          */
-        pthread_mutex_lock(&muti);
+        pthread_mutex_lock(&g->muti);
 
         /* blokujemy mutex wolnego watku by miec dostep do jego danych i kontrole nad jego startem */
         /* blocking mutex of the free thread to gain exclusive access to its data and to have a control over its start */
-        if ( pthread_mutex_lock(mutexy[freeProc]))
+        if ( pthread_mutex_lock(mutexy[g->freeProc]))
             perror("Manager cannot lock a thread after waking up\n");
 #ifdef DEBUG
         else
@@ -333,24 +324,34 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
 #ifdef DEBUG
         printf("\t\t[Manager]->Waiting for a thread splitting box\n");
 #endif
+        /* only a busy thread can split a box, with none of them there is nothing to wait for */
+        for ( busy = 0, i = 0; i < num_proc; i++ )
+            if ( i != g->freeProc ) {
+                pthread_mutex_lock(mutexy[i]);
+                busy += ( raporty[i].status == 1 );
+                pthread_mutex_unlock(mutexy[i]);
+            }
+
         pthread_mutex_lock(&sharingBox);
         clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec += timeout;
+        /* once cancelled nobody is going to split a box, so the thread is finished at once */
+        if ( ! cancelled(raporty[g->freeProc].fd) && busy > 0 )
+            ts.tv_sec += timeout;
         if ( (mstat = pthread_cond_timedwait(&newBox, &sharingBox, &ts)) == ETIMEDOUT ) {
             pthread_mutex_unlock(&sharingBox);
             /* we were waiting over 2 seconds for new box */
 #ifdef DEBUG
-            printf("\t\t\t[Manager]->Finishing thread #%d[TIMEDOUT]\n", freeProc);
+            printf("\t\t\t[Manager]->Finishing thread #%d[TIMEDOUT]\n", g->freeProc);
 #endif
-            raporty[freeProc]->status = 2;
+            raporty[g->freeProc].status = 2;
             nrProc--;
 
-            pthread_mutex_unlock(mutexy[freeProc]);
-            pthread_mutex_unlock(&muti);
-            pthread_cond_signal(&mdone);
+            pthread_mutex_unlock(mutexy[g->freeProc]);
+            pthread_mutex_unlock(&g->muti);
+            pthread_cond_signal(&g->mdone);
 
-            freeProc = -1;
-            pthread_cond_signal(&mfree);
+            g->freeProc = -1;
+            pthread_cond_signal(&g->mfree);
             continue;
         }
         else { //if ( mstat == 0 )
@@ -360,7 +361,8 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
 #ifdef DEBUG
             printf("\t\t\t[Manager]->Discovered some new boxes from thread #%d\n", i);
 #endif
-            if( i >= 0 ) {
+            /* woken by a finished thread, boxing may still name the one we serve (it split before) */
+            if( i >= 0 && i != g->freeProc ) {
                 pthread_mutex_lock(mutexy[i]);
 #ifdef DEBUG
                 printf("\t\t\t\t[Manager]->Having thread #%d locked\n", i);
@@ -368,18 +370,18 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
             }
             else {
                 /* zaden worker jeszcze nie podzielil */
-                /* none worker has split any box */
+                /* none worker has split any box (or no other one) */
 #ifdef DEBUG
                 printf("[Manager]->BOXING < 0 !!!\n");
 #endif
-                raporty[freeProc]->status = 0;
+                raporty[g->freeProc].status = 0;
 
-                pthread_mutex_unlock(mutexy[freeProc]);
-                pthread_mutex_unlock(&muti);
-                pthread_cond_signal(&mdone);
+                pthread_mutex_unlock(mutexy[g->freeProc]);
+                pthread_mutex_unlock(&g->muti);
+                pthread_cond_signal(&g->mdone);
 
-                freeProc = -1;
-                pthread_cond_signal(&mfree);
+                g->freeProc = -1;
+                pthread_cond_signal(&g->mfree);
                 continue;
             }
 
@@ -389,22 +391,22 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
              *
              * now let's check if the thread is really busy at the moment
              */
-            if ( raporty[i]->status == 1 ) {
-                if ( raporty[i]->bh == (raporty[i]->bl + 1)) {
+            if ( raporty[i].status == 1 ) {
+                if ( raporty[i].bh == (raporty[i].bl + 1)) {
                     pthread_mutex_unlock(mutexy[i]);
 
-                    raporty[freeProc]->status = 0;
+                    raporty[g->freeProc].status = 0;
 
-                    pthread_mutex_unlock(mutexy[freeProc]);
-                    pthread_mutex_unlock(&muti);
-                    pthread_cond_signal(&mdone);
+                    pthread_mutex_unlock(mutexy[g->freeProc]);
+                    pthread_mutex_unlock(&g->muti);
+                    pthread_cond_signal(&g->mdone);
 
-                    freeProc = -1;
-                    pthread_cond_signal(&mfree);
+                    g->freeProc = -1;
+                    pthread_cond_signal(&g->mfree);
                     continue;
                 }
 #ifdef DEBUG
-                printf("\t\t\t[Manager]->Thread #%d is splitting a box, [bl: %d, bh: %d]\n", i, raporty[i]->bl, raporty[i]->bh);
+                printf("\t\t\t[Manager]->Thread #%d is splitting a box, [bl: %d, bh: %d]\n", i, raporty[i].bl, raporty[i].bh);
 #endif
                 /*
                  * Mamy zajety watek o numerze i
@@ -421,21 +423,21 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
                  *	job1 = raporty[i]	//stopped
                  */
 #ifdef DEBUG
-                printf("\t\t\t[Manager]->Changing threads' raports.. freeProc=%d and i=%d\n", freeProc, i);
+                printf("\t\t\t[Manager]->Changing threads' raports.. freeProc=%d and i=%d\n", g->freeProc, i);
 #endif
-                raporty[freeProc]->bh = raporty[i]->bh;
-                raporty[i]->bh = raporty[i]->bl + (int)floor((raporty[i]->bh - raporty[i]->bl) / 2);
-                raporty[freeProc]->bl = raporty[i]->bh;
+                raporty[g->freeProc].bh = raporty[i].bh;
+                raporty[i].bh = raporty[i].bl + (int)floor((raporty[i].bh - raporty[i].bl) / 2);
+                raporty[g->freeProc].bl = raporty[i].bh;
 
-                if ( raporty[freeProc]->bl < raporty[freeProc]->bh )
-                    raporty[freeProc]->status = 1;
+                if ( raporty[g->freeProc].bl < raporty[g->freeProc].bh )
+                    raporty[g->freeProc].status = 1;
                 else
-                    raporty[freeProc]->status = 0;
+                    raporty[g->freeProc].status = 0;
 
-                if ( raporty[i]->bl < raporty[i]->bh )
-                    raporty[i]->status = 1;
+                if ( raporty[i].bl < raporty[i].bh )
+                    raporty[i].status = 1;
                 else
-                    raporty[i]->status = 0;
+                    raporty[i].status = 0;
 
 #ifdef DEBUG
                 printf("\t\t\t[Manager]->Unlocking threads..\n");
@@ -443,27 +445,27 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
                 /* Najpierw startujemy watek, ktory zaczyna od daleszej czesci */
                 /* First we start a thread that owns later part */
                 pthread_mutex_unlock(mutexy[i]);	
-                pthread_mutex_unlock(mutexy[freeProc]);
-                pthread_mutex_unlock(&muti);
-                pthread_cond_signal(&mdone);
+                pthread_mutex_unlock(mutexy[g->freeProc]);
+                pthread_mutex_unlock(&g->muti);
+                pthread_cond_signal(&g->mdone);
 
 #ifdef DEBUG
-                printf("\t\t\t[Manager]->Unlocked mutexes on: %d and %d\n", freeProc, i);
+                printf("\t\t\t[Manager]->Unlocked mutexes on: %d and %d\n", g->freeProc, i);
 #endif
 
-                freeProc = -1;
-                pthread_cond_signal(&mfree);
+                g->freeProc = -1;
+                pthread_cond_signal(&g->mfree);
                 continue;
             } else {
 #ifdef DEBUG
-                printf("\t\t\t[Manager]->Status of locked thread #%d: %d\n", i, raporty[i]->status);
+                printf("\t\t\t[Manager]->Status of locked thread #%d: %d\n", i, raporty[i].status);
 #endif			
                 pthread_mutex_unlock(mutexy[i]);
-                pthread_mutex_unlock(mutexy[freeProc]);
-                pthread_mutex_unlock(&muti);
-                pthread_cond_signal(&mdone);
-                freeProc = -1;
-                pthread_cond_signal(&mfree);
+                pthread_mutex_unlock(mutexy[g->freeProc]);
+                pthread_mutex_unlock(&g->muti);
+                pthread_cond_signal(&g->mdone);
+                g->freeProc = -1;
+                pthread_cond_signal(&g->mfree);
                 continue;
             }		
         }
@@ -472,52 +474,264 @@ manage_mb(pthread_t* threads, fdata** raporty, pthread_mutex_t** mutexy, int num
     return 0;
 }
 
+/*
+ * Hierarchical mode
+ *
+ * Every group of workers has a manager thread of its own which shares work
+ * within the group; only when nobody in the group has rows to give away, it
+ * turns to the top-level manager which looks at all workers. Requests no
+ * longer queue up at one manager and one condition variable.
+ */
+#define TAKE_PASSES	3	/* looks at all donors before the worker is told to ask again */
+
+/* take_rows */
+enum { TAKE_SHARED = 0, TAKE_NONE, TAKE_BUSY };
+
+typedef struct hierarchy hierarchy;
+
+typedef struct {
+    hierarchy* h;
+    mgroup* g;
+} group_arg;
+
+struct hierarchy {
+    int n;			/* number of groups */
+    mgroup* groups;
+    group_arg* args;
+    pthread_t* managers;	/* manager thread of every group */
+    wdata* raporty;
+    int num_proc;
+    pthread_barrier_t ready;	/* all managers wait for requests */
+};
+
 ///////////////////////////////////////
-int
-manager(const fdata* wzor)
+static int
+find_donor(const wdata* raporty, const int* members, int size, int self, int* below, int* after)
+    /*
+     * the worker with the most rows left, -1 if nobody has two of them;
+     * only workers ordered after the one tried before (*below rows, number
+     * *after) count, so that every donor of a pass is tried once; the rows
+     * are read without locking anybody, only the donor gets locked
+     */
 {
+    int k, i, left;
+    int best = -1, most = 1;
+    uint64_t r;
 
-    int i;
-    fdata* raport;
-    fdata** raporty;		/* list of  raports assigned to workers */
+    for ( k = 0; k < size; k++ ) {
+        i = ( members != NULL ) ? members[k] : k;
+        if ( i == self )
+            continue;
+        r = __atomic_load_n(&raporty[i].rows, __ATOMIC_RELAXED);
+        left = ROWS_HI(r) - ROWS_LO(r);
+        if ( left > *below || ( left == *below && i <= *after ) )
+            continue;
+        if ( left > most || ( left == most && best >= 0 && i < best ) ) {
+            most = left;
+            best = i;
+        }
+    }
+    if ( best >= 0 ) {
+        *below = most;
+        *after = best;
+    }
 
-    pthread_mutex_t* mutt;
-    pthread_mutex_t** mutexy;	/* list of mutexes assigned to workers */
+    return best;
+}
 
-    pthread_t* threads;		/* list of thread_ids */
+///////////////////////////////////////
+static int
+take_rows(wdata* raporty, const int* members, int size, wdata* idle)
+    /*
+     * gives the idle worker a half of the biggest job among the members: TAKE_SHARED,
+     * TAKE_NONE if nobody has two rows, TAKE_BUSY if those who have were locked all the time
+     */
+{
+    int i, k, pass, shared, busy, below, after;
 
-#ifdef DEBUG
-    printf("[Manager]->manager\n");
-#endif
+    for ( pass = 0; pass < TAKE_PASSES; pass++ ) {
+        below = INT_MAX;
+        after = -1;
+        busy = 0;
+        for ( k = 0; k < size && (i = find_donor(raporty, members, size, idle->wID, &below, &after)) >= 0; k++ ) {
+            /*
+             * the donor may be served by another manager at the moment,
+             * then the next best one is tried instead of waiting for it
+             */
+            if ( pthread_mutex_trylock(&raporty[i].mutt) ) {
+                busy = 1;
+                continue;
+            }
+            shared = raporty[i].status == 1 && ! split_rows(&raporty[i], idle);
+            pthread_mutex_unlock(&raporty[i].mutt);
+            if ( shared )
+                return TAKE_SHARED;
+        }
+        /* all the donors were looked at; only a busy one is worth another pass */
+        if ( ! busy )
+            return TAKE_NONE;
+        sched_yield();
+    }
+
+    return TAKE_BUSY;
+}
 
-    /* Using sequential algorithm */
-    if ( wzor->num_proc == 1 ) {
+///////////////////////////////////////
+static void*
+manage_group(void* arg)
+{
+    hierarchy* h = ((group_arg*) arg)->h;
+    mgroup* g = ((group_arg*) arg)->g;
+    wdata* idle;
+    int nrProc = g->size;	/* how many threads of the group exist */
+    int taken;
+
+    pthread_mutex_lock(&g->mutex);
+    pthread_barrier_wait(&h->ready);
+
+    while ( nrProc > 0 ) {
+        pthread_cond_wait(&g->cond, &g->mutex);
+#ifdef DEBUG
+        printf("\t\t[Manager-%d]->MANAGER AWAKENED by worker-%d!!!\n", (int)(g - h->groups), g->freeProc);
+#endif
+        idle = &h->raporty[g->freeProc];
+        pthread_mutex_lock(&idle->mutt);
+        pthread_mutex_lock(&g->muti);
+
+        /* first from our group, then from anybody through the top-level manager */
+        taken = take_rows(h->raporty, g->members, g->size, idle);
+        if ( taken != TAKE_SHARED ) {
+            pthread_mutex_lock(&top);
+            taken = take_rows(h->raporty, NULL, h->num_proc, idle);
+            pthread_mutex_unlock(&top);
+        }
+        if ( taken == TAKE_BUSY ) {
+            /* the donors still have rows; the worker asks again instead of being let go */
+            idle->status = 0;
+        } else if ( taken == TAKE_NONE ) {
 #ifdef DEBUG
-        printf("[Manager]->gen_fractal_sq\n");
+            printf("\t\t\t[Manager-%d]->Finishing thread #%d\n", (int)(g - h->groups), g->freeProc);
 #endif
-        gen_fractal_sq(wzor);
-        return 0;
+            idle->status = 2;
+            nrProc--;
+        }
+
+        pthread_mutex_unlock(&idle->mutt);
+        pthread_mutex_unlock(&g->muti);
+        pthread_cond_signal(&g->mdone);
+
+        g->freeProc = -1;
+        pthread_cond_signal(&g->mfree);
     }
+    pthread_mutex_unlock(&g->mutex);
+
+    return NULL;
+}
+
+///////////////////////////////////////
+static void
+start_groups(hierarchy* h, wdata* raporty, int num_proc, int n)
+    /* workers sorted by their sockets are cut into n groups, whose managers are started */
+{
+    int i, j, w;
+    int* members = (int*) malloc(num_proc * sizeof(int));
+
+    /* workers of one socket next to each other */
+    for ( i = 0; i < num_proc; i++ ) {
+        w = i;
+        for ( j = i; j > 0 && affinity_socket(members[j - 1]) > affinity_socket(w); j-- )
+            members[j] = members[j - 1];
+        members[j] = w;
+    }
+
+    h->n = n;
+    h->raporty = raporty;
+    h->num_proc = num_proc;
+    h->groups = (mgroup*) malloc(n * sizeof(mgroup));
+    h->args = (group_arg*) malloc(n * sizeof(group_arg));
+    h->managers = (pthread_t*) malloc(n * sizeof(pthread_t));
+    pthread_barrier_init(&h->ready, NULL, n + 1);
+
+    for ( j = 0; j < n; j++ ) {
+        mgroup* g = &h->groups[j];
+
+        g->freeProc = -1;
+        g->frees = 0;
+        pthread_cond_init(&g->cond, NULL);
+        pthread_cond_init(&g->mfree, NULL);
+        pthread_cond_init(&g->mdone, NULL);
+        pthread_mutex_init(&g->mutex, NULL);
+        pthread_mutex_init(&g->muti, NULL);
+        g->members = members + (size_t)j * num_proc / n;
+        g->size = (int)((size_t)(j + 1) * num_proc / n - (size_t)j * num_proc / n);
+        for ( i = 0; i < g->size; i++ )
+            raporty[g->members[i]].grp = g;
+
+        h->args[j].h = h;
+        h->args[j].g = g;
+        pthread_create(&h->managers[j], NULL, manage_group, &h->args[j]);
+    }
+
+    /* workers may ask for a job as soon as they start */
+    pthread_barrier_wait(&h->ready);
+}
+
+///////////////////////////////////////
+static void
+stop_groups(hierarchy* h)
+{
+    int j;
+
+    for ( j = 0; j < h->n; j++ ) {
+        pthread_join(h->managers[j], NULL);
+        pthread_cond_destroy(&h->groups[j].cond);
+        pthread_cond_destroy(&h->groups[j].mfree);
+        pthread_cond_destroy(&h->groups[j].mdone);
+        pthread_mutex_destroy(&h->groups[j].mutex);
+        pthread_mutex_destroy(&h->groups[j].muti);
+    }
+    pthread_barrier_destroy(&h->ready);
+
+    free(h->groups[0].members);
+    free(h->groups);
+    free(h->args);
+    free(h->managers);
+}
+
+///////////////////////////////////////
+int
+gen_fractal_pthreads(const fdata* wzor)
+    /* POSIX Threads workers handed out work by the manager (rows or MagicBox boxes) */
+{
+
+    int i;
+    wdata* raporty;		/* list of  raports assigned to workers, cache line aligned */
+
+    pthread_mutex_t** mutexy;	/* list of mutexes assigned to workers */
+
+    pthread_t* threads;		/* list of thread_ids */
+    int* order;			/* order in which manage looks for a busy thread */
+    hierarchy h;		/* managers of the groups of workers (wzor->groups > 0) */
 
 #ifdef DEBUG
     printf("[Manager]->Number of threads: %d\n", wzor->num_proc);
 #endif
-    /* Using OpenMP */
-    if ( wzor->use_omp ) {
-#ifdef DEBUG
-        printf("[Manager]->gen_fractal_omp\n");
-#endif
-        gen_fractal_omp(wzor);
-        return 0;
-    }
+
+    /* manager may be called many times in one process (e.g. by serve) */
+    boxing = -1;
 
     /*
      * allocating threads
      */
     threads = (pthread_t*) malloc(wzor->num_proc * sizeof(pthread_t));
 
-    raporty = (fdata**) malloc(wzor->num_proc * sizeof(fdata*));
+    if ( posix_memalign((void**) &raporty, CACHE_LINE, wzor->num_proc * sizeof(wdata)) ) {
+        perror("[Manager]->posix_memalign");
+        free(threads);
+        return 1;
+    }
     mutexy = (pthread_mutex_t**) malloc(wzor->num_proc * sizeof(pthread_mutex_t*));
+    order = affinity_scan_order(wzor->num_proc);
 
     /*
      * Zakladamy mutex poniewaz tworzone procesy zaczynaja upominac sie o przydzialy pracy
@@ -527,27 +741,29 @@ manager(const fdata* wzor)
      * startujemy watki.
      * Next we create requiered data structures, initilize them and start the threads
      */
-    pthread_mutex_lock(&mutex);
+    for(i = wzor->num_proc - 1; i >= 0; i--) {
+        /* init raport together with the worker's mutex */
+        if(wzor->use_mb)
+            init_raport_mb(&raporty[i], wzor, i);
+        else
+            init_raport(&raporty[i], wzor, i);
+        mutexy[i] = &raporty[i].mutt;
+        raporty[i].grp = &mgr;
+    }
+
+    if ( wzor->groups > 0 )
+        start_groups(&h, raporty, wzor->num_proc, wzor->groups);
+    else
+        pthread_mutex_lock(&mgr.mutex);
+
     for(i = wzor->num_proc - 1; i >= 0; i--) {
 
 #ifdef DEBUG
         printf("[Manager]->Creating thread: %d\n", i);
 #endif
 
-        /* creation and initialisation of the worker's mutex with default values */
-        mutexy[i] = mutt = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
-        pthread_mutex_init(mutt, NULL);
-
-        raporty[i] = raport = (fdata*) malloc(sizeof(fdata));
-
-        /* init raport */
-        if(wzor->use_mb)
-            init_raport_mb(raport, wzor, i, mutt);
-        else
-            init_raport(raport, wzor, i, mutt);
-
         /* create thread */
-        if( pthread_create(&threads[i], NULL, worker, (void*)raport) ) {
+        if( pthread_create(&threads[i], NULL, worker, (void*)&raporty[i]) ) {
             printf("\t[Manager]->ERROR; return code from pthread_create() is not 0\n");
         }
     }
@@ -557,14 +773,19 @@ manager(const fdata* wzor)
      * Tworzenie watkow zostalo ukonczone, przekazujemy sterowanie do funkcji, ktora nimi zarzadza
      * The threads have been created, we pass the control to the function that manages them
      */
-    if(wzor->use_mb)
-        manage_mb(threads, raporty, mutexy, wzor->num_proc);
-    else
-        manage(threads, raporty, mutexy, wzor->num_proc); //pamietajmy o mutexie
+    if ( wzor->groups > 0 ) {
+        /* the groups' managers do it */
+        stop_groups(&h);
+    } else {
+        if(wzor->use_mb)
+            manage_mb(&mgr, raporty, mutexy, wzor->num_proc);
+        else
+            manage(&mgr, raporty, mutexy, wzor->num_proc, order); //pamietajmy o mutexie
 
-    /* po skonczonym zarzadzaniu i zamknieciu innych watkow mozemy zwolnic mutex */
-    /* after finishing managing and having other threads joined, we can release the mutex*/
-    pthread_mutex_unlock(&mutex);
+        /* po skonczonym zarzadzaniu i zamknieciu innych watkow mozemy zwolnic mutex */
+        /* after finishing managing and having other threads joined, we can release the mutex*/
+        pthread_mutex_unlock(&mgr.mutex);
+    }
 
     /*
      * Oczekiwanie na zakonczenie kolejnych watkow
@@ -584,14 +805,34 @@ manager(const fdata* wzor)
      */
     for(i=0; i < wzor->num_proc; i++) {
         pthread_mutex_destroy(mutexy[i]);
-        free(mutexy[i]);
-        free(raporty[i]);
     }
 
     free(mutexy); mutexy = NULL;
     free(raporty); raporty = NULL;
     free(threads); threads = NULL;
+    free(order); order = NULL;
 
     return 0;
 }
 
+///////////////////////////////////////
+int
+manager(const fdata* wzor)
+{
+    const backend* b;
+
+#ifdef DEBUG
+    printf("[Manager]->manager\n");
+#endif
+
+    /* Distributing tiles to worker processes */
+    if ( wzor->hosts != NULL )
+        return coordinator(wzor);
+
+    b = backend_get(wzor->backend);
+#ifdef DEBUG
+    printf("[Manager]->%s\n", b->name);
+#endif
+    return b->render(wzor);
+}
+
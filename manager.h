@@ -9,5 +9,6 @@
 #define SUPERH
 
 extern int manager(const fdata*);
+extern int gen_fractal_pthreads(const fdata*);
 
 #endif
@@ -11,28 +11,102 @@
 #include <cmath>
 #include <unistd.h>
 #include <ctype.h>
-
-#ifdef TESTED
-
+#include <strings.h>
+#include <getopt.h>
 #include <sys/time.h>
 #include <time.h>
 
-#endif
-
 #include "mandelbrot_set.h"
 #include "worker.h"
 #include "manager.h"
+#include "distributor.h"
+#include "shm_output.h"
+#include "checkpoint.h"
+#include "colour.h"
+#include "orbit.h"
+#include "antialias.h"
+#include "affinity.h"
+#include "buddhabrot.h"
+#include "formula.h"
+#include "backend.h"
+#include "deadline.h"
+#include "queue.h"
+#include "autotune.h"
+#include "perfctr.h"
+#include "check.h"
+#include "pyramid.h"
+#include "png.h"
+#include "outpipe.h"
 ///////////////////////////////////////
 char *ofile = NULL;
+char *waddr = NULL;	/* [host:]port to listen on in the worker mode */
+char *sname = NULL;	/* shared memory segment holding the picture */
+char *vname = NULL;	/* shared memory segment to be viewed */
+char *ckfile = NULL;	/* checkpoint file */
+int ckevery = 10;	/* seconds between checkpoints */
+int resume = 0;		/* whether to resume from the checkpoint */
+int equalize = 0;	/* whether to colour by histogram equalization */
+palette pal;		/* palette loaded from a file, pal.n == 0 if none */
+char *zfile = NULL;	/* state of the points which have not escaped */
+int aasamples = 0;	/* sub-samples of every edge pixel, 0 - no anti-aliasing */
+aa_data* aa = NULL;	/* sub-samples taken */
+char *affinity = NULL;	/* policy of pinning workers to CPUs */
+long long bsamples = 0;	/* samples of the Buddhabrot, 0 - escape time picture */
+int deadline = 0;	/* milliseconds the render may take, 0 - no limit */
+char *qfile = NULL;	/* job file of the render queue, "-" - standard input */
+long qmemory = 1024;	/* megabytes the jobs of the queue may take at once */
+int tune = 0;		/* whether to choose the configuration by probing */
+int nthreads = 0;	/* -n as given, 0 if it was not */
+char *profile = NULL;	/* tuned configurations, $HOME/.eds_autotune if not given */
+int perf = 0;		/* whether to report hardware counters */
+char *check = NULL;	/* self-check of the backends, "update" also rewrites the baseline */
+char *baseline = NULL;	/* throughput of the self-check, $HOME/.eds_baseline if not given */
+long long lanes[2];	/* busy and all SIMD lane-iterations, counted with -E */
+char *pdir = NULL;	/* directory of the pyramid of the picture */
+int ptile = 256;	/* side of a tile of the pyramid */
+int pfilter = PF_BOX;	/* downsampling filter of the pyramid */
+pyramid* pyr = NULL;	/* pyramid whose first levels are built during the render */
+int pngmode = -1;	/* pixels of a .png output file, -1 - palette, rgb with -a */
+int async = 0;		/* whether to write the PPM file while rendering */
+
+static struct option long_options[] = {
+    {"checkpoint",	required_argument,	0, 'k'},
+    {"checkpoint-every",	required_argument,	0, 'K'},
+    {"resume",		no_argument,		0, 'R'},
+    {"equalize",		no_argument,		0, 'H'},
+    {"palette",		required_argument,	0, 'P'},
+    {"orbits",		required_argument,	0, 'z'},
+    {"antialias",		required_argument,	0, 'a'},
+    {"distance",		no_argument,		0, 'd'},
+    {"affinity",		required_argument,	0, 'A'},
+    {"groups",		required_argument,	0, 'G'},
+    {"buddhabrot",	required_argument,	0, 'b'},
+    {"formula",		required_argument,	0, 'F'},
+    {"backend",		required_argument,	0, 'B'},
+    {"deadline-ms",	required_argument,	0, 'D'},
+    {"queue",		required_argument,	0, 'Q'},
+    {"queue-memory",	required_argument,	0, 'M'},
+    {"autotune",		no_argument,		0, 'U'},
+    {"profile",		required_argument,	0, 'j'},
+    {"perf",		no_argument,		0, 'E'},
+    {"selfcheck",		optional_argument,	0, 'V'},
+    {"baseline",		required_argument,	0, 'L'},
+    {"kernel",		required_argument,	0, 'I'},
+    {"pyramid",		required_argument,	0, 'T'},
+    {"pyramid-tile",	required_argument,	0, 'W'},
+    {"pyramid-filter",	required_argument,	0, 'Z'},
+    {"png-mode",		required_argument,	0, 'N'},
+    {"async-output",	no_argument,		0, 'O'},
+    {"help",		no_argument,		0, 'h'},
+    {0, 0, 0, 0}
+};
 ///////////////////////////////////////
 
-static int
-write_ppm(fdata* fd, char* filename)
+int
+write_ppm(fdata* fd, const unsigned char* rgb, char* filename)
+    /* rgb holds the coloured picture starting with the top row */
 {
     FILE *fp;
-    int x, y;
-    char r, g, b;
-    char colour;
 
 #ifdef DEBUG
     printf("[Main]->write_ppm\n");
@@ -41,20 +115,14 @@ write_ppm(fdata* fd, char* filename)
         fp = fopen("mandelbrot_set.ppm", "wb");
     else
         fp = fopen(filename, "wb");
+    if ( fp == NULL ) {
+        perror("[Main]->write_ppm");
+        return 1;
+    }
 
     /* Inserting the PPM's header */
     fprintf(fp, "P6\n%d %d\n%d\n", fd->resolution, fd->resolution, 255);
-    /* Writing down sequentially pixels' values starting with the maximum Y, so with the top */
-    for(y=fd->resolution-1; y >= 0; y--) {
-        for(x=0; x < fd->resolution; x++) {
-            colour = fd->tab[y][x];
-            r = g = (9 * colour) % 255;
-            /* kolejne kolory teczy. najbardziej rzadkie to najdluzsza fala -> czerwone, najczestsze to krotka fala - fiolet */
-            b = (r ^ g) % 255;
-            //					r = g = b = (9 * colour) % 255; 
-            fprintf(fp, "%c%c%c", r, g, b);
-        }
-    }
+    fwrite(rgb, 3, (size_t)fd->resolution * fd->resolution, fp);
     fprintf(fp, "\n");
     fclose(fp);
 
@@ -66,16 +134,12 @@ write_ppm(fdata* fd, char* filename)
     static int 
 clean_table(fdata* fd)
 {
-    int i;
-
 #ifdef DEBUG
     printf("[Main]->clean_table\n");
 #endif
 
-    for(i=0; i < fd->resolution; i++) {
-        free(fd->tab[i]);
-        fd->tab[i] = NULL;
-    }
+    /* rows live in one block starting at the first one */
+    free(fd->tab[0]);
     free(fd->tab);
     fd->tab = NULL;
 
@@ -95,16 +159,58 @@ gen_table(fdata* fd)
 #endif
 
     tab = (char**)malloc(fd->resolution * sizeof(char*));
-    /* do we need to initialize it with 0s? */
-    for(i=0; i < fd->resolution; i++)
-        tab[i] = (char*)malloc(fd->resolution * sizeof(char));
+    /*
+     * one block which is not touched here: its pages are placed on the NUMA node
+     * of the worker which writes them first
+     */
+    tab[0] = (char*)malloc((size_t)fd->resolution * fd->resolution * sizeof(char));
+    for(i=1; i < fd->resolution; i++)
+        tab[i] = tab[0] + (size_t)i * fd->resolution;
     fd->tab = tab;
+    fd->touch = 1;
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+gen_counts(fdata* fd)
+    /* full iteration counts besides tab, for the colours of a maxiter which does not fit in it */
+{
+    int i;
+
+#ifdef DEBUG
+    printf("[Main]->gen_counts\n");
+#endif
+
+    fd->counts = (int**)malloc(fd->resolution * sizeof(int*));
+    if ( fd->counts == NULL || (fd->counts[0] = (int*)malloc((size_t)fd->resolution * fd->resolution * sizeof(int))) == NULL ) {
+        printf("Error: Not enough memory for the iteration counts\n");
+        free(fd->counts);
+        fd->counts = NULL;
+        return 1;
+    }
+    for(i=1; i < fd->resolution; i++)
+        fd->counts[i] = fd->counts[0] + (size_t)i * fd->resolution;
 
     return 0;
 }
 
 ///////////////////////////////////////
 
+static void
+clean_counts(fdata* fd)
+{
+    if ( fd->counts == NULL )
+        return;
+    free(fd->counts[0]);
+    free(fd->counts);
+    fd->counts = NULL;
+}
+
+///////////////////////////////////////
+
 static int 
 usage(char* appName)
 {
@@ -119,12 +225,60 @@ usage(char* appName)
     printf("-i\t\tMaximal number of iterations [default: 200]\n");
     printf("-t\t\tThreshold [default: 2]\n");
     printf("-n\t\tNumber of simultanously running threads [default: 1 (runs sequentially)]\n");
+    printf("-F, --formula\t\tmandelbrot, julia:RE,IM, multibrot:D (D up to %d) or burningship [default: mandelbrot]\n", MULTIBROT_MAX);
+    printf("-I, --kernel\t\tsimd (lanes reloaded as their points finish), interleaved (%d scalar orbits at once) or point [default: %s]\n",
+            IL_ORBITS, SIMD_NATIVE ? "simd" : "interleaved");
     printf("\n");
-    printf("-m\t\tImplies using MagicBox and POSIX Threads [default: not set]\n");
-    printf("-o\t\tImplies using OpenMP (turns off MagicBox) [default: not set]\n");
+    printf("-m\t\tImplies using MagicBox [default: not set]\n");
+    printf("-o\t\tImplies using OpenMP (with -m MagicBox runs as OpenMP tasks) [default: not set]\n");
     printf("-p\t\tImplies using POSIX Threads [default: set]\n");
     printf("-s\t\tSmallest box size (when using MagicBox maximal number of times the rectangle is divided) [default: 4]\n");
-    printf("-f\t\tOutput filename [default: mandelbrot_set.ppm]\n");
+    printf("-d, --distance\t\tMagicBox fills boxes lying far from the set using distance estimation [default: not set]\n");
+    printf("-A, --affinity\t\tPins workers to CPUs: compact, scatter or a CPU list like 0,2,8-15 [default: not set]\n");
+    printf("-G, --groups\t\tSplits POSIX Threads workers into groups (by socket) with managers of their own [default: 0 (one manager)]\n");
+    printf("-B, --backend\t\tRenders with the named backend, \"list\" shows them [default: chosen by -n, -o and -m]\n");
+    printf("-U, --autotune\t\tProbes backends, threads (up to -n if given), -s and -c at low resolution and renders with the fastest\n");
+    printf("\t\t\t[default: not set]\n");
+    printf("-j, --profile\t\tFile keeping the tuned configuration of every machine [default: $HOME/.eds_autotune]\n");
+    printf("-c\t\tChunk size of the OpenMP dynamic schedule and rows taken at once by the threads backend [default: 1]\n");
+    printf("-l\t\tCollapses rows and columns into one OpenMP loop [default: not set]\n");
+    printf("-D, --deadline-ms\tRenders coarse to fine and stops after the given milliseconds with the best picture so far [default: not set]\n");
+    printf("-f\t\tOutput filename, a PNG file if it ends with .png [default: mandelbrot_set.ppm]\n");
+    printf("-N, --png-mode\t\tPixels of a PNG file: rgb, palette (the counts index the colours) or gray (the counts)\n");
+    printf("\t\t\t[default: palette, rgb with -a]\n");
+    printf("-O, --async-output\tWrites the PPM file while rendering, block by block as rows finish (io_uring, O_DIRECT);\n");
+    printf("\t\t\tnot with -H, -a, -b, -D, -T or a PNG file [default: not set]\n");
+    printf("-T, --pyramid\t\tWrites the picture as tiles of levels downsampled 2x into the directory, no file unless -f [default: not set]\n");
+    printf("-W, --pyramid-tile\tSide of a tile of the pyramid [default: 256]\n");
+    printf("-Z, --pyramid-filter\tbox or lanczos [default: box]\n");
+    printf("\n");
+    printf("-e\t\tDistributes tiles to worker processes host:port[,host:port...] [default: not set]\n");
+    printf("-g\t\tSide of a tile sent to a worker process, at most 4096 [default: 256]\n");
+    printf("-w\t\tRuns as a worker process listening on [host:]port, the loopback unless a host is given;\n");
+    printf("\t\t\t0.0.0.0:port listens on every interface and takes tiles from anybody [default: not set]\n");
+    printf("\n");
+    printf("-Q, --queue\t\tRenders the jobs of the file (\"-\" - standard input) on one pool of -n threads, a line per job:\n");
+    printf("\t\t\txmin xmax ymin ymax resolution maxiter [priority [file]] [default: not set]\n");
+    printf("-M, --queue-memory\tMegabytes the jobs of the queue may take at once [default: 1024]\n");
+    printf("\n");
+    printf("-S\t\tRenders into the named shared memory segment, no file unless -f [default: not set]\n");
+    printf("-v\t\tWaits for the picture in the named shared memory segment and saves it [default: not set]\n");
+    printf("\n");
+    printf("-k, --checkpoint\tKeeps the picture in the given checkpoint file while rendering [default: not set]\n");
+    printf("-K, --checkpoint-every\tSeconds between checkpoints [default: 10]\n");
+    printf("-R, --resume\t\tResumes the render saved in the checkpoint file [default: not set]\n");
+    printf("\n");
+    printf("-H, --equalize\t\tColours by histogram equalization of the iteration counts [default: not set]\n");
+    printf("-P, --palette\t\tPalette file, one \"r g b\" line per colour [default: built-in]\n");
+    printf("-a, --antialias\t\tSub-samples taken in every pixel lying on an edge (at most %d) [default: 0]\n", AA_MAX);
+    printf("-b, --buddhabrot\tRenders the density of escaping orbits (Buddhabrot) from the given number of samples of c [default: not set]\n");
+    printf("-z, --orbits\t\tState file of the points which have not escaped; a render with higher -i continues them [default: not set]\n");
+    printf("-E, --perf\t\tReports hardware counters (perf_event_open) of every phase and worker thread [default: not set]\n");
+    printf("\n");
+    printf("-V, --selfcheck\t\tCompares every backend with -n threads against the sequential one and the golden\n");
+    printf("\t\t\tchecksums of canonical viewports, and the throughput against the baseline;\n");
+    printf("\t\t\t-Vupdate or --selfcheck=update rewrites the baseline [default: not set]\n");
+    printf("-L, --baseline\t\tFile keeping the self-check throughput of every machine [default: $HOME/.eds_baseline]\n");
     printf("-h\t\tPrints this help\n");
 
     return 0;
@@ -132,6 +286,46 @@ usage(char* appName)
 
 ///////////////////////////////////////
 
+static int
+parse_kernel(fdata* fd, const char* s)
+{
+    if ( ! strcmp(s, "simd") )
+        fd->kernel = K_SIMD;
+    else if ( ! strcmp(s, "interleaved") )
+        fd->kernel = K_INTERLEAVED;
+    else if ( ! strcmp(s, "point") )
+        fd->kernel = K_POINT;
+    else {
+        printf("Error: Unknown kernel: %s\n", s);
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+parse_formula(fdata* fd, const char* s)
+{
+    if ( ! strcmp(s, "mandelbrot") )
+        fd->formula = F_MANDELBROT;
+    else if ( sscanf(s, "julia:%lf,%lf", &fd->jre, &fd->jim) == 2 )
+        fd->formula = F_JULIA;
+    else if ( sscanf(s, "multibrot:%d", &fd->power) == 1 && fd->power >= 2 && fd->power <= MULTIBROT_MAX )
+        fd->formula = ( fd->power == 2 ) ? F_MANDELBROT : F_MULTIBROT;
+    else if ( ! strcmp(s, "burningship") )
+        fd->formula = F_BURNING_SHIP;
+    else {
+        printf("Error: Unknown formula: %s\n", s);
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
 static int
 verify(fdata* fd)
 {
@@ -148,6 +342,60 @@ verify(fdata* fd)
         printf("Error: Wrong smallestBoxSize was given\n");
         return 1;
     }
+    if (fd->omp_chunk < 1) {
+        printf("Error: Wrong OpenMP chunk size was given\n");
+        return 1;
+    }
+    if (pdir != NULL && (ptile < 1 || pfilter < 0)) {
+        printf("Error: Wrong pyramid tile size or filter was given\n");
+        return 1;
+    }
+    if (fd->hosts != NULL && (fd->tile < 1 || fd->tile > EDS_MAX_TILE)) {
+        printf("Error: Wrong tile size was given, at most %d\n", EDS_MAX_TILE);
+        return 1;
+    }
+    if (resume && ckfile == NULL) {
+        printf("Error: --resume requires a checkpoint file (-k)\n");
+        return 1;
+    }
+    if (ckfile != NULL && (sname != NULL || ckevery < 1)) {
+        printf("Error: Checkpoint cannot be used with shared memory and needs a positive period\n");
+        return 1;
+    }
+    if (aasamples < 0 || aasamples > AA_MAX) {
+        printf("Error: Wrong number of anti-aliasing sub-samples was given\n");
+        return 1;
+    }
+    if (fd->groups < 0 || fd->groups > fd->num_proc || (fd->groups > 0 && fd->backend != backend_find("pthreads"))) {
+        printf("Error: Wrong number of groups was given (at most -n, POSIX Threads without MagicBox only)\n");
+        return 1;
+    }
+    if (bsamples < 0 || (bsamples > 0 && (zfile != NULL || aasamples > 0 || fd->hosts != NULL || ckfile != NULL || equalize))) {
+        printf("Error: Buddhabrot needs a positive number of samples and cannot be used with -z, -a, -e, -k or -H\n");
+        return 1;
+    }
+    if (fd->formula != F_MANDELBROT && (fd->use_de || zfile != NULL || bsamples > 0)) {
+        printf("Error: -d, -z and -b work with the Mandelbrot formula only\n");
+        return 1;
+    }
+    if (deadline < 0 || (deadline > 0 && (zfile != NULL || aasamples > 0 || fd->hosts != NULL || ckfile != NULL || bsamples > 0))) {
+        printf("Error: Deadline needs a positive number of milliseconds and cannot be used with -z, -a, -e, -k or -b\n");
+        return 1;
+    }
+    if (qmemory < 1 || (qfile != NULL && (zfile != NULL || aasamples > 0 || fd->hosts != NULL || ckfile != NULL || bsamples > 0
+                    || deadline > 0 || sname != NULL || vname != NULL || waddr != NULL))) {
+        printf("Error: Queue needs a positive memory budget and cannot be used with -z, -a, -e, -k, -b, -D, -S, -v or -w\n");
+        return 1;
+    }
+    if (check != NULL && strcmp(check, "") && strcmp(check, "update")) {
+        printf("Error: --selfcheck takes \"update\" only\n");
+        return 1;
+    }
+    if (tune && (fd->groups > 0 || fd->hosts != NULL || zfile != NULL || bsamples > 0 || qfile != NULL
+                || vname != NULL || waddr != NULL)) {
+        printf("Error: Autotune chooses the backend itself and cannot be used with -B, -G, -e, -z, -b, -Q, -v or -w\n");
+        return 1;
+    }
     if (fd->num_proc < 1) {
         printf("Error: Too few processes were set\n");
         return 1;
@@ -163,6 +411,7 @@ static int
 init_fd(fdata* fd, int argc, char* argv[])
 {
     int sBox;
+    char* bname = NULL;	/* backend given by its name */
 
 #ifdef DEBUG
     printf("[Main]->init_fd\n");
@@ -183,12 +432,17 @@ init_fd(fdata* fd, int argc, char* argv[])
     fd->num_proc = 1;
     fd->use_mb = 0;
     fd->use_omp = 0;
+    fd->omp_chunk = 1;
+    fd->omp_collapse = 0;
+    fd->kernel = K_DEFAULT;
+    fd->hosts = NULL;
+    fd->tile = 256;
     sBox = 4;
     fd->sbs = 0;
 
     opterr = 0;
 
-    while ((c = getopt (argc, argv, "x:X:y:Y:r:i:t:n:f:mophs:")) != -1)
+    while ((c = getopt_long (argc, argv, "x:X:y:Y:r:i:t:n:f:mophs:c:le:g:w:S:v:k:K:RHP:z:a:dA:G:b:F:B:D:Q:M:Uj:EV::L:I:T:W:Z:N:O", long_options, NULL)) != -1)
         switch (c) {
             case 'x':
                 fd->xmin = atof(optarg);
@@ -212,17 +466,15 @@ init_fd(fdata* fd, int argc, char* argv[])
                 fd->T = atof(optarg);
                 break;
             case 'n':
-                fd->num_proc = atoi(optarg);
+                fd->num_proc = nthreads = atoi(optarg);
                 break;
             case 'f':
                 ofile = optarg;
                 break;
             case 'm':
                 fd->use_mb = 1;
-                fd->use_omp = 0;
                 break;
             case 'o':
-                fd->use_mb = 0;
                 fd->use_omp = 1;
                 break;
             case 'p':
@@ -233,12 +485,123 @@ init_fd(fdata* fd, int argc, char* argv[])
                 return 1;
             case 's':
                 fd->use_mb = 1;
-                fd->use_omp = 0;
                 sBox = atoi(optarg);
                 break;
+            case 'c':
+                fd->omp_chunk = atoi(optarg);
+                break;
+            case 'l':
+                fd->omp_collapse = 1;
+                break;
+            case 'd':
+                fd->use_mb = 1;
+                fd->use_de = 1;
+                break;
+            case 'A':
+                affinity = optarg;
+                break;
+            case 'G':
+                fd->groups = atoi(optarg);
+                break;
+            case 'B':
+                bname = optarg;
+                break;
+            case 'D':
+                deadline = atoi(optarg);
+                break;
+            case 'Q':
+                qfile = optarg;
+                break;
+            case 'M':
+                qmemory = atol(optarg);
+                break;
+            case 'U':
+                tune = 1;
+                break;
+            case 'E':
+                perf = 1;
+                break;
+            case 'V':
+                check = optarg ? optarg : (char*)"";
+                break;
+            case 'L':
+                baseline = optarg;
+                break;
+            case 'j':
+                profile = optarg;
+                break;
+            case 'I':
+                if ( parse_kernel(fd, optarg) )
+                    return 1;
+                break;
+            case 'T':
+                pdir = optarg;
+                break;
+            case 'W':
+                ptile = atoi(optarg);
+                break;
+            case 'Z':
+                pfilter = pyramid_filter(optarg);
+                break;
+            case 'O':
+                async = 1;
+                break;
+            case 'N':
+                if ( (pngmode = png_mode(optarg)) < 0 ) {
+                    printf("Error: Unknown PNG mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'F':
+                if ( parse_formula(fd, optarg) )
+                    return 1;
+                break;
+            case 'b':
+                /* 1e9 is fine too */
+                bsamples = (long long)atof(optarg);
+                break;
+            case 'e':
+                fd->hosts = optarg;
+                break;
+            case 'g':
+                fd->tile = atoi(optarg);
+                break;
+            case 'w':
+                waddr = optarg;
+                break;
+            case 'S':
+                sname = optarg;
+                break;
+            case 'v':
+                vname = optarg;
+                break;
+            case 'k':
+                ckfile = optarg;
+                break;
+            case 'K':
+                ckevery = atoi(optarg);
+                break;
+            case 'R':
+                resume = 1;
+                break;
+            case 'H':
+                equalize = 1;
+                break;
+            case 'P':
+                if ( load_palette(optarg, &pal) )
+                    return 1;
+                break;
+            case 'z':
+                zfile = optarg;
+                break;
+            case 'a':
+                aasamples = atoi(optarg);
+                break;
 
             case '?':
-                if ( strchr("xXyYritnfs", optopt) && optopt != 0 )
+                if ( optopt == 0 )
+                    fprintf (stderr, "Unknown option `%s'.\n", argv[optind - 1]);
+                else if ( strchr("xXyYritnfscegwSvkKPzaAGbFBDQMjLITWZN", optopt) )
                     fprintf (stderr, "Option -%c requires an argument.\n", optopt);
                 else if (isprint (optopt))
                     fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -249,16 +612,37 @@ init_fd(fdata* fd, int argc, char* argv[])
                 return 1;
         }
 
+    if ( bname != NULL ) {
+        if ( ! strcmp(bname, "list") ) {
+            backend_list();
+            return 1;
+        }
+        if ( tune ) {
+            printf("Error: Autotune chooses the backend itself, -B cannot be given\n");
+            return 1;
+        }
+        if ( (fd->backend = backend_find(bname)) < 0 ) {
+            printf("Error: Unknown backend: %s\n", bname);
+            backend_list();
+            return 1;
+        }
+        /* the flags follow the backend */
+        fd->use_mb = backend_get(fd->backend)->use_mb;
+        fd->use_omp = backend_get(fd->backend)->use_omp;
+    } else
+        fd->backend = backend_default(fd);
+
     if ( sBox > 0 )
-        fd->sbs = (int) pow( (fd->resolution / pow(2,sBox)), 2);
+        fd->sbs = box_size(fd->resolution, sBox);
 
     if ( verify(fd) ) {
         usage(argv[0]);
         return 1;
     }
 
-    fd->wID = -1;
-    fd->mutt = NULL;
+    if ( affinity != NULL && affinity_init(affinity, fd->num_proc) )
+        return 1;
+    affinity_report(fd->num_proc);
 
     fd->xdiff = (fd->xmax - fd->xmin) / fd->resolution;
     fd->ydiff = (fd->ymax - fd->ymin) / fd->resolution;
@@ -267,7 +651,6 @@ init_fd(fdata* fd, int argc, char* argv[])
 }
 
 ///////////////////////////////////////
-#ifdef TESTED
 double my_wtime()
 {
     struct timeval tv;
@@ -275,7 +658,81 @@ double my_wtime()
     gettimeofday(&tv, NULL);
     return (double)tv.tv_sec + (double)tv.tv_usec * 1E-6;
 }
-#endif
+
+///////////////////////////////////////
+
+static int
+is_png(const char* filename)
+{
+    size_t l = ( filename != NULL ) ? strlen(filename) : 0;
+
+    return l >= 4 && ! strcasecmp(filename + l - 4, ".png");
+}
+
+///////////////////////////////////////
+
+static int
+save_picture(fdata* fd, char* filename)
+    /* colouring and writing are separate stages, each one timed on its own */
+{
+    rgb_t* lut;
+    unsigned char* rgb;
+    double ctime, wtime;
+    int rc;
+
+    perf_phase_begin("colour");
+    ctime = - my_wtime();
+    lut = (rgb_t*)malloc(colour_size(fd) * sizeof(rgb_t));
+    rgb = (unsigned char*)malloc((size_t)fd->resolution * fd->resolution * 3);
+    if ( lut == NULL || rgb == NULL ) {
+        printf("Error: Not enough memory for the coloured picture\n");
+        free(lut);
+        free(rgb);
+        perf_phase_end();
+        return 1;
+    }
+    if ( bsamples > 0 )
+        rc = density_lut(pal.n ? &pal : NULL, lut);
+    else
+        rc = colour_lut(fd, pal.n ? &pal : NULL, equalize, lut);
+    if ( rc ) {
+        free(lut);
+        free(rgb);
+        perf_phase_end();
+        return 1;
+    }
+    colour_apply(fd, lut, rgb);
+    if ( aa != NULL )
+        aa_colour(fd, aa, lut, rgb);
+    ctime += my_wtime();
+    perf_phase_end();
+
+    perf_phase_begin("write");
+    wtime = - my_wtime();
+    rc = 0;
+    if ( pdir != NULL && pyr == NULL )
+        rc = pyramid_write(fd, rgb, pdir, ptile, pfilter);
+    if ( is_png(filename) ) {
+        if ( pngmode < 0 )
+            pngmode = ( aa != NULL || fd->counts != NULL ) ? PNG_RGB : PNG_PALETTE;
+        else if ( pngmode == PNG_PALETTE && fd->counts != NULL ) {
+            /* the palette of a PNG file has 256 colours at most */
+            printf("[Main]->maxiter %d does not fit in a PNG palette, writing RGB\n", fd->maxiter);
+            pngmode = PNG_RGB;
+        }
+        rc |= write_png(fd, rgb, lut, pngmode, filename);
+    } else if ( pdir == NULL || filename != NULL )
+        rc |= write_ppm(fd, rgb, filename);
+    wtime += my_wtime();
+    perf_phase_end();
+
+    printf("Colour time: %.3f\n", ctime);
+    printf("Write time: %.3f\n", wtime);
+    free(rgb);
+    free(lut);
+
+    return rc;
+}
 
 ///////////////////////////////////////
 ///////////////////////////////////////
@@ -284,9 +741,13 @@ int
 main (int argc, char* argv[])
 {
     fdata* fd;
-#ifdef TESTED
-    double etime;
+    int i;
     int sManager; // manager exit status
+    int wide;	// whether the full counts are kept besides tab
+    double etime;
+    int status = 0; // exit status
+#ifndef TESTED
+    outpipe* op = NULL;
 #endif
 
     printf("=======  EDS - Eve's Distribution System  =======\n");
@@ -303,7 +764,87 @@ main (int argc, char* argv[])
         free(fd);
         return 1;
     }
-    gen_table(fd);
+
+    /* worker process renders tiles for a coordinator and has no picture of its own */
+    if ( waddr != NULL ) {
+        i = serve(fd, waddr);
+        free(fd);
+        return i;
+    }
+
+    if ( check != NULL ) {
+        char path[1024];
+
+        if ( baseline == NULL ) {
+            snprintf(path, sizeof(path), "%s/.eds_baseline", getenv("HOME") ? getenv("HOME") : ".");
+            baseline = path;
+        }
+        i = selfcheck(fd, baseline, ! strcmp(check, "update"));
+        free(fd);
+        return i;
+    }
+
+    /* every job of the queue has a picture of its own */
+    if ( qfile != NULL ) {
+        i = queue_run(fd, qfile, qmemory, pal.n ? &pal : NULL, equalize);
+        free(fd);
+        free_palette(&pal);
+        return i;
+    }
+
+    /* viewer only reads the picture rendered by another process */
+    if ( vname != NULL ) {
+        if ( ! (i = shm_view(fd, vname)) )
+            i = save_picture(fd, ofile);
+        shm_detach(fd);
+        free(fd);
+        return i;
+    }
+
+    if ( tune ) {
+        char path[1024];
+
+        if ( profile == NULL ) {
+            snprintf(path, sizeof(path), "%s/.eds_autotune", getenv("HOME") ? getenv("HOME") : ".");
+            profile = path;
+        }
+        if ( autotune(fd, profile, nthreads) ) {
+            free(fd);
+            return 1;
+        }
+        profile = NULL;
+    }
+
+    if ( perf ) {
+        perf_init(fd->num_proc);
+        fd->lanes = lanes;
+    }
+
+    /* a maxiter which does not fit in tab needs the full counts for the palette and equalization */
+    wide = colour_wide(fd, pal.n ? &pal : NULL, equalize) && bsamples == 0;
+
+    perf_phase_begin("allocate");
+    if ( sname != NULL ) {
+        if ( shm_attach(fd, sname) ) {
+            free(fd);
+            return 1;
+        }
+    } else if ( ckfile != NULL ) {
+        if ( checkpoint_open(fd, ckfile, resume, ckevery, wide) ) {
+            free(fd);
+            return 1;
+        }
+    } else
+        gen_table(fd);
+    if ( wide && fd->counts == NULL && gen_counts(fd) ) {
+        if ( sname != NULL )
+            shm_detach(fd);
+        else
+            clean_table(fd);
+        free(fd);
+        return 1;
+    }
+    perf_phase_end();
 
 #ifdef TESTED
     etime = - my_wtime();
@@ -313,13 +854,108 @@ main (int argc, char* argv[])
 
     //if ( ! sManager ) write_ppm(fd, ofile);
 #else
-    if ( ! manager(fd))
-        write_ppm(fd, ofile);
+    if ( (async || pdir != NULL) && (sname == NULL || ofile != NULL) ) {
+        rgb_t* lut = NULL;
+
+        /* the colours have to be known before the rows */
+        if ( ! (equalize || aasamples > 0 || bsamples > 0 || deadline > 0) ) {
+            lut = (rgb_t*)malloc(colour_size(fd) * sizeof(rgb_t));
+            if ( lut != NULL && colour_lut(fd, pal.n ? &pal : NULL, 0, lut) ) {
+                free(lut);
+                lut = NULL;
+            }
+        }
+        if ( pdir != NULL ) {
+            if ( lut == NULL )
+                printf("[Main]->The pyramid needs fixed colours, building it after the render\n");
+            else
+                pyr = pyramid_start(fd, lut, pdir, ptile, pfilter);
+        }
+        /* with a pyramid there is no PPM file unless -f names one */
+        if ( async && (pdir == NULL || ofile != NULL) ) {
+            if ( lut == NULL || (pdir != NULL && pyr == NULL) || is_png(ofile) )
+                printf("[Main]->The output pipeline needs fixed colours and a PPM file, writing after the render\n");
+            else
+                op = outpipe_start(fd, lut, ofile ? ofile : "mandelbrot_set.ppm");
+        }
+        free(lut);
+    }
+
+    perf_phase_begin("compute");
+    etime = - my_wtime();
+    if ( zfile != NULL )
+        sManager = orbit_render(fd, zfile);
+    else if ( bsamples > 0 )
+        sManager = buddha_render(fd, bsamples);
+    else if ( deadline > 0 ) {
+        printf("Backend: %s, %d threads, deadline %d ms\n", backend_get(fd->backend)->name, fd->num_proc, deadline);
+        sManager = deadline_render(fd, deadline);
+    } else {
+        if ( fd->hosts == NULL )
+            printf("Backend: %s, %d threads\n", backend_get(fd->backend)->name, fd->num_proc);
+        sManager = manager(fd);
+    }
+    etime += my_wtime();
+    perf_phase_end();
+    printf("Elapsed time: %.3f\n", etime);
+
+    if ( ! sManager && aasamples > 0 ) {
+        perf_phase_begin("antialias");
+        etime = - my_wtime();
+        aa = aa_render(fd, aasamples);
+        etime += my_wtime();
+        perf_phase_end();
+        printf("Antialias time: %.3f\n", etime);
+        /* no picture rather than one without the anti-aliasing asked for */
+        if ( aa == NULL )
+            status = 1;
+    }
+
+    if ( ! sManager ) {
+        /* rows filled by the backends which do not report them row by row */
+        for(i=0; i < fd->resolution; i++)
+            row_done(fd, i);
+        if ( ! status && op == NULL && (sname == NULL || ofile != NULL) && (pyr == NULL || ofile != NULL) )
+            status = save_picture(fd, ofile);
+    }
+    /* the pipeline may share the rows' flags of the pyramid, so it is finished first */
+    if ( op != NULL ) {
+        /* only the blocks of the last rows are left */
+        perf_phase_begin("write");
+        etime = - my_wtime();
+        if ( outpipe_finish(op, ! sManager) )
+            status = 1;
+        etime += my_wtime();
+        perf_phase_end();
+        printf("Write time: %.3f\n", etime);
+    }
+    if ( pyr != NULL ) {
+        /* the rest of levels 0 and 1, then the small levels */
+        perf_phase_begin("pyramid");
+        etime = - my_wtime();
+        if ( pyramid_finish(pyr, ! sManager) )
+            status = 1;
+        pyr = NULL;
+        etime += my_wtime();
+        perf_phase_end();
+        printf("Pyramid time: %.3f\n", etime);
+    }
+    perf_report();
+    if ( lanes[1] > 0 )
+        printf("[Perf]->SIMD lanes busy: %.1f%% of %lld lane-iterations\n", 100.0 * lanes[0] / lanes[1], lanes[1]);
 #endif
 
-    clean_table(fd);
+    if ( sname != NULL )
+        shm_detach(fd);
+    else if ( ckfile != NULL )
+        checkpoint_close(fd, ! sManager);
+    else
+        clean_table(fd);
+    clean_counts(fd);
     free(fd);
+    free_palette(&pal);
+    aa_free(aa);
 
-    return 0;
+    return status;
 }
 
@@ -9,6 +9,8 @@
 #define MANSETH
 
 #include <pthread.h>	
+#include <stdint.h>
+#include <math.h>
 
 #define DEBUG
 #ifdef TESTED
@@ -19,17 +21,29 @@
  * SHARED VARIABLES
  */
 
-extern int freeProc;	/* threads are numbered from 0 on, -1 means invalid or none */
-extern int frees;	/* the number of workers waiting for a job */
-extern int boxing;	/* number of thread currently splitting its box */
+/*
+ * Manager's side of handing out jobs; one serves all workers,
+ * or every group of workers has its own (see fdata.groups)
+ */
+typedef struct {
+    int freeProc;	/* threads are numbered from 0 on, -1 means invalid or none */
+    int frees;	/* the number of workers waiting for a job */
 
-extern pthread_cond_t cond;	/* budzenie managera; worker wakes up manager */
-extern pthread_cond_t mfree;	/* manager moze przyjac nowy watek; manager can serve calling thread */
-extern pthread_cond_t mdone;	/* manager skonczyl zmieniac dane watku; manager has finished working on current thread */
-extern pthread_cond_t newBox;	/* watek zaczyna nowy box; new box is going to be processed */
+    pthread_cond_t cond;	/* budzenie managera; worker wakes up manager */
+    pthread_cond_t mfree;	/* manager moze przyjac nowy watek; manager can serve calling thread */
+    pthread_cond_t mdone;	/* manager skonczyl zmieniac dane watku; manager has finished working on current thread */
+
+    pthread_mutex_t mutex;	/* one needs manager */
+    pthread_mutex_t muti;	/* being locked by a worker when it finishes its job */
 
-extern pthread_mutex_t mutex;	/* one needs manager */
-extern pthread_mutex_t muti;	/* being locked by a worker when it finishes its job */
+    int* members;	/* workers of the group, NULL when it serves all of them */
+    int size;	/* number of the members */
+} mgroup;
+
+extern mgroup mgr;	/* the manager of all workers */
+
+extern int boxing;	/* number of thread currently splitting its box */
+extern pthread_cond_t newBox;	/* watek zaczyna nowy box; new box is going to be processed */
 extern pthread_mutex_t sharingBox;	/* for sharing a job in MagicBox */
 
 
@@ -39,32 +53,110 @@ extern pthread_mutex_t sharingBox;	/* for sharing a job in MagicBox */
 typedef struct {
     double ydiff, xdiff;	/* distances between adjoining pixels */
     char** tab;		/* table with results */
+    int** counts;		/* full iteration counts besides tab when the colours need more than its 256 values, NULL otherwise */
+    char* rowdone;		/* finished rows' flags (shared memory or checkpoint), NULL otherwise */
+    int touch;		/* whether workers first-touch their rows (tab is not filled yet) */
 
     /* image's parameters */
     double xmin, xmax;	/* x range */
     double ymin, ymax; 	/* y range */
     int resolution;	/* resolution of the picture */
+    int xo, yo;		/* pixel offset of the picture when it is a tile of a bigger one */
 
     int maxiter;		/* maximal number of iterations */
     double T;		/* threshold */
 
+    int formula;		/* fractal family (F_* of formula.h) */
+    int power;		/* d of the Multibrot z^d + c */
+    double jre, jim;	/* c of the Julia set */
+
     int num_proc;		/* number of threads */
+    int backend;		/* engine rendering the picture (index in the registry of backend.h) */
     int use_mb, use_omp;	/* whether to use MagicBox or not */
     int sbs;		/* smallest box size for MagicBox (in square pixels) */
+    int use_de;		/* whether MagicBox fills boxes far from the set using distance estimation */
+    int omp_chunk;		/* chunk size of the OpenMP dynamic schedule */
+    int omp_collapse;	/* whether to collapse rows and columns into one OpenMP loop */
+    int kernel;		/* escape-time kernel of rows and boxes (K_* of formula.h) */
+    long long* lanes;	/* busy and all SIMD lane-iterations of the render, NULL if not counted */
 
-    /* Workers' individual data */
-    int yl, yh, xl, xh;	/* assigned work */
+    char* hosts;		/* workers' addresses (host:port,...) for distributed rendering */
+    int tile;		/* side of a tile sent to a worker process (in pixels) */
+    int groups;		/* groups of workers with managers of their own, 0 - one manager for all */
+    int* cancel;		/* set when the render has to stop (deadline), NULL if it never does */
+
+} fdata;
+
+#define CACHE_LINE 64
+
+/*
+ * Workers' individual data
+ *
+ * Parameters of the picture are shared read-only through fd; every worker's
+ * state takes whole cache lines of its own, so the manager writing to one
+ * worker does not disturb the others.
+ */
+typedef struct {
+    const fdata* fd;	/* parameters of the picture, common for all workers */
+    uint64_t rows;		/* assigned rows [yl, yh) packed by ROWS(), taken one by one atomically */
+    int yl, yh, xl, xh;	/* box being processed (MagicBox) */
     int bl, bh;		/* assigned work - BoxLow BoxHigh */
     int wID;		/* worker's ID */
-    pthread_mutex_t* mutt;	/* thread's mutex */
+    pthread_mutex_t mutt;	/* thread's mutex */
+    mgroup* grp;		/* manager serving the worker */
     int status;		/* thread's status (0 - free, 1 - busy, 2 - released) */
+} __attribute__((aligned(CACHE_LINE))) wdata;
 
-} fdata;
+/* rows [lo, hi) in one word, so that a worker and the manager can change them with a CAS */
+#define ROWS(lo, hi)	(((uint64_t)(uint32_t)(hi) << 32) | (uint32_t)(lo))
+#define ROWS_LO(r)	((int)(uint32_t)(r))
+#define ROWS_HI(r)	((int)(uint32_t)((r) >> 32))
 
 typedef struct {
     double xmin, xmax;
     double ymin, ymax;
 } cords;
 
+/* marks row y of the picture as finished */
+static inline void
+row_done(const fdata* fd, int y)
+{
+    if ( fd->rowdone != NULL )
+        __atomic_store_n(&fd->rowdone[fd->yo + y], 1, __ATOMIC_RELEASE);
+}
+
+/* escape time v of pixel (x, y), also kept in full when the picture has counts */
+static inline void
+put_count(const fdata* fd, int x, int y, int v)
+{
+    fd->tab[y][x] = v;
+    if ( fd->counts != NULL )
+        fd->counts[y][x] = v;
+}
+
+/* whether row y is already there (e.g. resumed from a checkpoint) */
+static inline int
+row_is_done(const fdata* fd, int y)
+{
+    return fd->rowdone != NULL && __atomic_load_n(&fd->rowdone[fd->yo + y], __ATOMIC_ACQUIRE);
+}
+
+/* smallest MagicBox box (in square pixels) of a picture divided sBox times */
+static inline int
+box_size(int resolution, int sBox)
+{
+    return (int) pow( (resolution / pow(2,sBox)), 2);
+}
+
+/* picture coloured by colour_apply into a PPM file (mandelbrot_set.cpp) */
+extern int write_ppm(fdata*, const unsigned char* rgb, char* filename);
+
+/* whether the render was told to stop; workers check it between rows and boxes */
+static inline int
+cancelled(const fdata* fd)
+{
+    return fd->cancel != NULL && __atomic_load_n(fd->cancel, __ATOMIC_RELAXED);
+}
+
 #endif
 
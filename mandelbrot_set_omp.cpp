@@ -15,36 +15,132 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <complex>
 #include <omp.h>
 
 #include "mandelbrot_set.h"
 #include "mandelbrot_set_omp.h"
+#include "formula.h"
+#include "distance.h"
+#include "affinity.h"
+#include "perfctr.h"
 
 using namespace std;
 
-static int 
-fractal_point(complex<double> c, const fdata *fd) //oblicza jak szybko ucieka punkt o wspolrzednych zespolonych
+///////////////////////////////////////
+static void
+count_box_omp(const fdata* d, int yl, int yh, int xl, int xh)
+{
+    int y;
+
+    for ( y = yl; y < yh; y++ )
+        render_span(d, y, xl, xh);
+}
+
+///////////////////////////////////////
+static void
+fill_box_omp(const fdata* d, int yl, int yh, int xl, int xh, int v)
+{
+    int x, y;
+
+    for ( y = yl; y < yh; y++ )
+        for ( x = xl; x < xh; x++ )
+            put_count(d, x, y, v);
+}
+
+///////////////////////////////////////
+static void
+process_box_omp(const fdata* d, int yl, int yh, int xl, int xh)
     /*
-       Z0 = 0
-       Zn = Z(n-1) + C
+     * Mariani-Silver subdivision: if the whole border of the box has
+     * the same value, the box is filled with it, otherwise it is split
+     * into 4 smaller boxes, each processed as a separate OpenMP task
+     */
+{
+    int x, y, p, ym, xm;
+    int uniform = 1;
+
+    if ( yh <= yl || xh <= xl || cancelled(d) )
+        return;
+
+    /* box lying far from the set is filled at once */
+    if ( d->use_de && exterior_cell(d, yl, yh, xl, xh, &p) ) {
+        fill_box_omp(d, yl, yh, xl, xh, p);
+        return;
+    }
+
+    p = pixel_point(d, xl, yl);
+    for ( x = xl; x < xh && uniform; x++ )
+        if ( pixel_point(d, x, yl) != p || pixel_point(d, x, yh-1) != p )
+            uniform = 0;
+    for ( y = yl; y < yh && uniform; y++ )
+        if ( pixel_point(d, xl, y) != p || pixel_point(d, xh-1, y) != p )
+            uniform = 0;
+
+    if ( uniform ) {
+        fill_box_omp(d, yl, yh, xl, xh, p);
+        return;
+    }
+
+    /* box too small to be worth splitting, we count it normally */
+    if ( (xh - xl) * (yh - yl) < d->sbs || xh - xl < 2 || yh - yl < 2 ) {
+        count_box_omp(d, yl, yh, xl, xh);
+        return;
+    }
+
+    ym = yl + (yh - yl) / 2;
+    xm = xl + (xh - xl) / 2;
 
-       abs(c) <T
-       */
+#pragma omp taskgroup
+    {
+#pragma omp task firstprivate(yl, ym, xl, xm)
+        process_box_omp(d, yl, ym, xl, xm);
+#pragma omp task firstprivate(yl, ym, xm, xh)
+        process_box_omp(d, yl, ym, xm, xh);
+#pragma omp task firstprivate(ym, yh, xl, xm)
+        process_box_omp(d, ym, yh, xl, xm);
+#pragma omp task firstprivate(ym, yh, xm, xh)
+        process_box_omp(d, ym, yh, xm, xh);
+    }
+}
+
+///////////////////////////////////////
+static void
+first_touch_omp(const fdata* d)
+    /* every thread touches its static share of rows, so pages are spread over the NUMA nodes */
 {
-    complex<double> Zn;
-    int n;
+    int y;
 
-    if ( abs(c) >= fd->T ) //point is already over the range
-        return 0;
+    if ( ! d->touch )
+        return;
 
-    for ( n=1, Zn=c;  //zaczynamy od 1 bo przeciez punkt nie jest od razu poza zasiegiem
-            abs(Zn)< fd->T && n < fd->maxiter+1;
-            ++n) {
-        Zn = Zn * Zn + c ;
+#pragma omp parallel for default(none) shared(d) schedule(static)
+    for ( y = 0; y < d->resolution; y++ ) {
+        affinity_pin(omp_get_thread_num());
+        memset(d->tab[y], 0, d->resolution);
     }
+}
 
-    return n-1; //due to last incrementation in the FOR loop
+///////////////////////////////////////
+int
+gen_fractal_omp_mb(const fdata* d)
+    /* MagicBox implemented with OpenMP tasks instead of the pthreads manager */
+{
+    omp_set_num_threads(d->num_proc);
+    first_touch_omp(d);
+#pragma omp parallel default(shared)
+    {
+        affinity_pin(omp_get_thread_num());
+        perf_thread_begin();
+#pragma omp single nowait
+        process_box_omp(d, 0, d->resolution, 0, d->resolution);
+        /* the tasks are done by the barrier of the single's region */
+#pragma omp barrier
+        perf_thread_end("omp", omp_get_thread_num());
+    }
+
+    return 0;
 }
 
 ///////////////////////////////////////
@@ -53,29 +149,32 @@ gen_fractal_omp(const fdata* d)
 {
     int yl;
     int xl;
-    complex<double> c;
-
-    double ydiff = d->ydiff;
-    double xdiff = d->xdiff;
-
-    char** tab = d->tab;
-
-    double xmin = d->xmin;
-    double xmax = d->xmax; 
-    double ymin = d->ymin;
-    double ymax = d->ymax; 
+    int chunk = d->omp_chunk > 0 ? d->omp_chunk : 1;
 
     //void omp_set_num_threads(int num_threads)
     omp_set_num_threads(d->num_proc);
-#pragma omp parallel default(shared) private(xl, yl)
+    first_touch_omp(d);
+    if ( affinity_enabled() ) {
+#pragma omp parallel
+        affinity_pin(omp_get_thread_num());
+    }
+
+    /* every per-pixel variable is declared private; c is computed inside pixel_point */
+#pragma omp parallel default(none) shared(d, chunk) private(xl, yl)
     {
-#pragma omp for schedule(dynamic)
-        for(yl = 0 ; yl < d->resolution; yl++) {
-            for(xl=0; xl < d->resolution; xl++) {
-                c = complex<double>(xmin+(xl+0.5)*xdiff, ymin+(yl+0.5)*ydiff);
-                tab[yl][xl] = fractal_point(c, d);
-            }
+        perf_thread_begin();
+        if ( d->omp_collapse ) {
+#pragma omp for collapse(2) schedule(dynamic, chunk)
+            for(yl = 0 ; yl < d->resolution; yl++)
+                for(xl=0; xl < d->resolution; xl++)
+                    if ( ! row_is_done(d, yl) && ! cancelled(d) )
+                        put_count(d, xl, yl, pixel_point(d, xl, yl));
+        } else {
+#pragma omp for schedule(dynamic, chunk)
+            for(yl = 0 ; yl < d->resolution; yl++)
+                render_row(d, yl);
         }
+        perf_thread_end("omp", omp_get_thread_num());
     }
 
     return 0;
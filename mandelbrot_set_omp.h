@@ -11,5 +11,6 @@
 #include "mandelbrot_set.h"
 
 extern int gen_fractal_omp(const fdata*);
+extern int gen_fractal_omp_mb(const fdata*);
 
 #endif
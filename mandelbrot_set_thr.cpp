@@ -0,0 +1,66 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Samoprzydzielanie pracy
+ * Self-scheduling with C++11 threads
+ *
+ * There is no manager: every thread takes the next chunk of rows from
+ * one atomic counter until the picture runs out. A baseline for the
+ * manager-based backends.
+ */
+
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "mandelbrot_set.h"
+#include "mandelbrot_set_thr.h"
+#include "formula.h"
+#include "affinity.h"
+#include "perfctr.h"
+
+using namespace std;
+
+///////////////////////////////////////
+
+static void
+thr_worker(const fdata* d, atomic<int>* next, int chunk, int id)
+{
+    int yl, y;
+
+    affinity_pin(id);
+    perf_thread_begin();
+
+    while ( (yl = next->fetch_add(chunk, memory_order_relaxed)) < d->resolution )
+        for ( y = yl; y < yl + chunk && y < d->resolution; y++ )
+            render_row(d, y);
+
+    perf_thread_end("thread", id);
+}
+
+///////////////////////////////////////
+int
+gen_fractal_thr(const fdata* d)
+{
+    atomic<int> next(0);	/* first row nobody has taken yet */
+    int chunk = d->omp_chunk > 0 ? d->omp_chunk : 1;
+    vector<thread> team;
+    int i;
+
+#ifdef DEBUG
+    printf("[Threads]->gen_fractal_thr: %d threads, %d rows at once\n", d->num_proc, chunk);
+#endif
+
+    for ( i = 0; i < d->num_proc; i++ )
+        team.push_back(thread(thr_worker, d, &next, chunk, i));
+    for ( i = 0; i < d->num_proc; i++ )
+        team[i].join();
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef MANSETTHR
+#define MANSETTHR
+
+#include "mandelbrot_set.h"
+
+extern int gen_fractal_thr(const fdata*);
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Rendering which keeps the state of the points which have not escaped
+ *
+ * Besides the picture, the state file holds Zn and the iteration index
+ * of every point which reached maxiter. A later render of the same view
+ * with a higher maxiter copies the escaped points and only continues
+ * the iterations of the stored ones, from where they stopped; the result
+ * is the same as rendering from Z0 with the new maxiter. The picture is
+ * stored as full counts when the render keeps them (fdata.counts), so only
+ * a render which keeps them too can continue such a state.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <complex>
+#include <stdint.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "orbit.h"
+
+using namespace std;
+
+#define ORBIT_MAGIC	0x4252424f	/* "OBRB" */
+#define ORBIT_VERSION	2
+#define ORBIT_CHUNK	4096	/* first capacity of the list of bounded points */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t resolution;
+    int32_t maxiter;	/* maxiter the state was computed with */
+    int32_t wide;		/* whether the pixels are full counts (int32) instead of bytes */
+    int32_t pad;
+    double xmin, xmax;
+    double ymin, ymax;
+    double T;
+    uint64_t count;		/* number of stored points */
+} orbit_header;
+
+/* a point which has not escaped */
+typedef struct {
+    uint64_t idx;		/* y * resolution + x */
+    int32_t n;		/* iteration index */
+    int32_t pad;
+    double re, im;		/* Zn */
+} orbit_state;
+
+/* the states gathered by the rows */
+typedef struct {
+    orbit_state* st;
+    uint64_t count, cap;
+} orbit_list;
+
+///////////////////////////////////////
+
+static int
+orbit_point(complex<double> c, complex<double>* Z, int* n, const fdata* fd)
+    /*
+     * the loop of fractal_point, but it starts from the state (*Z, *n)
+     * and leaves there the state it has reached
+     */
+{
+    complex<double> Zn = *Z;
+    int i = *n;
+
+    for ( ; abs(Zn) < fd->T && i < fd->maxiter+1; i++ )
+        Zn = Zn * Zn + c;
+
+    *Z = Zn;
+    *n = i;
+
+    return i-1; //due to the last incrementation in the FOR loop
+}
+
+///////////////////////////////////////
+
+static inline complex<double>
+pixel(const fdata* fd, uint64_t idx)
+{
+    int x = idx % fd->resolution, y = idx / fd->resolution;
+
+    return complex<double>(fd->xmin+(fd->xo+x+0.5)*fd->xdiff, fd->ymin+(fd->yo+y+0.5)*fd->ydiff);
+}
+
+///////////////////////////////////////
+
+static int
+load_state(const fdata* fd, const char* file, orbit_header* h, orbit_state** st)
+    /* reads the state of the same view computed with maxiter not higher than ours */
+{
+    FILE* fp;
+    int x, y;
+
+    fp = fopen(file, "rb");
+    if ( fp == NULL )
+        return 1;
+
+    if ( fread(h, sizeof(*h), 1, fp) != 1 || h->magic != ORBIT_MAGIC || h->version != ORBIT_VERSION
+            || h->resolution != fd->resolution || h->xmin != fd->xmin || h->xmax != fd->xmax
+            || h->ymin != fd->ymin || h->ymax != fd->ymax || h->T != fd->T || h->maxiter > fd->maxiter
+            || h->wide != ( fd->counts != NULL ) ) {
+        printf("[Orbit]->State in %s does not fit, rendering from scratch\n", file);
+        fclose(fp);
+        return 1;
+    }
+
+    for ( y = 0; y < fd->resolution; y++ ) {
+        if ( fd->counts != NULL ) {
+            if ( fread(fd->counts[y], sizeof(int32_t), fd->resolution, fp) != (size_t)fd->resolution )
+                break;
+            for ( x = 0; x < fd->resolution; x++ )
+                fd->tab[y][x] = fd->counts[y][x];
+        } else if ( fread(fd->tab[y], 1, fd->resolution, fp) != (size_t)fd->resolution )
+            break;
+    }
+
+    if ( h->count > (uint64_t)fd->resolution * fd->resolution ) {
+        printf("[Orbit]->State in %s is damaged, rendering from scratch\n", file);
+        fclose(fp);
+        return 1;
+    }
+    *st = (orbit_state*)malloc((h->count ? h->count : 1) * sizeof(orbit_state));
+    if ( *st == NULL ) {
+        printf("[Orbit]->Not enough memory for the state in %s, rendering from scratch\n", file);
+        fclose(fp);
+        return 1;
+    }
+    if ( y < fd->resolution || fread(*st, sizeof(orbit_state), h->count, fp) != h->count ) {
+        printf("[Orbit]->State in %s is truncated, rendering from scratch\n", file);
+        free(*st);
+        *st = NULL;
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+save_state(const fdata* fd, const char* file, const orbit_state* st, uint64_t count)
+{
+    FILE* fp;
+    orbit_header h;
+    int y;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = ORBIT_MAGIC;
+    h.version = ORBIT_VERSION;
+    h.resolution = fd->resolution;
+    h.maxiter = fd->maxiter;
+    h.wide = ( fd->counts != NULL );
+    h.xmin = fd->xmin, h.xmax = fd->xmax;
+    h.ymin = fd->ymin, h.ymax = fd->ymax;
+    h.T = fd->T;
+    h.count = count;
+
+    fp = fopen(file, "wb");
+    if ( fp == NULL ) {
+        perror("[Orbit]->save_state");
+        return 1;
+    }
+    fwrite(&h, sizeof(h), 1, fp);
+    for ( y = 0; y < fd->resolution; y++ )
+        if ( fd->counts != NULL )
+            fwrite(fd->counts[y], sizeof(int32_t), fd->resolution, fp);
+        else
+            fwrite(fd->tab[y], 1, fd->resolution, fp);
+    fwrite(st, sizeof(orbit_state), count, fp);
+    fclose(fp);
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static uint64_t
+compact(orbit_state* st, const char* bounded, uint64_t count)
+    /* keeps only the points which are still bounded */
+{
+    uint64_t i, k;
+
+    for ( i = k = 0; i < count; i++ )
+        if ( bounded[i] )
+            st[k++] = st[i];
+
+    return k;
+}
+
+///////////////////////////////////////
+
+static int
+list_append(orbit_list* l, const orbit_state* p, int n)
+    /* called by one thread at a time; 1 if there is no memory */
+{
+    orbit_state* st;
+    uint64_t cap;
+
+    if ( l->count + n > l->cap ) {
+        for ( cap = l->cap ? 2 * l->cap : ORBIT_CHUNK; cap < l->count + n; cap *= 2 )
+            ;
+        if ( (st = (orbit_state*)realloc(l->st, cap * sizeof(orbit_state))) == NULL )
+            return 1;
+        l->st = st;
+        l->cap = cap;
+    }
+    memcpy(l->st + l->count, p, n * sizeof(orbit_state));
+    l->count += n;
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+by_idx(const void* a, const void* b)
+{
+    uint64_t i = ((const orbit_state*)a)->idx, j = ((const orbit_state*)b)->idx;
+
+    return ( i > j ) - ( i < j );
+}
+
+///////////////////////////////////////
+int
+orbit_render(fdata* fd, const char* file)
+{
+    orbit_header h;
+    orbit_state* st = NULL;
+    orbit_list list;
+    uint64_t count;
+    char* bounded;
+    int failed = 0;
+    long i;
+
+#ifdef DEBUG
+    printf("[Orbit]->orbit_render: %s\n", file);
+#endif
+
+    omp_set_num_threads(fd->num_proc);
+
+    if ( ! load_state(fd, file, &h, &st) ) {
+        /* escaped points are already in tab, stored ones continue */
+        count = h.count;
+        printf("[Orbit]->Continuing %llu points from maxiter %d to %d\n",
+                (unsigned long long)count, h.maxiter, fd->maxiter);
+        if ( (bounded = (char*)malloc(count ? count : 1)) == NULL ) {
+            printf("Error: Not enough memory to continue the state in %s\n", file);
+            free(st);
+            return 1;
+        }
+
+#pragma omp parallel for default(none) shared(fd, st, bounded, count) schedule(dynamic, 256)
+        for ( i = 0; i < (long)count; i++ ) {
+            complex<double> Z(st[i].re, st[i].im);
+            int n = st[i].n;
+            int v = orbit_point(pixel(fd, st[i].idx), &Z, &n, fd);
+
+            put_count(fd, st[i].idx % fd->resolution, st[i].idx / fd->resolution, v);
+            st[i].re = Z.real();
+            st[i].im = Z.imag();
+            st[i].n = n;
+            bounded[i] = ( v == fd->maxiter );
+        }
+
+        count = compact(st, bounded, count);
+        free(bounded);
+    } else {
+        /*
+         * every pixel from Z0; a row gathers the state of its bounded points
+         * and appends them to the list, so only they are ever kept
+         */
+        memset(&list, 0, sizeof(list));
+
+#pragma omp parallel default(none) shared(fd, list, failed)
+        {
+            orbit_state* row = (orbit_state*)malloc(fd->resolution * sizeof(orbit_state));
+            int x, y, k;
+
+            if ( row == NULL ) {
+#pragma omp critical (orbit_list)
+                failed = 1;
+            }
+
+#pragma omp for schedule(dynamic)
+            for ( y = 0; y < fd->resolution; y++ ) {
+                for ( x = k = 0; x < fd->resolution; x++ ) {
+                    uint64_t idx = (uint64_t)y * fd->resolution + x;
+                    complex<double> c = pixel(fd, idx);
+                    complex<double> Z = c;
+                    int n = 1, v = 0;
+
+                    if ( abs(c) < fd->T )	//point is not already over the range
+                        v = orbit_point(c, &Z, &n, fd);
+
+                    put_count(fd, x, y, v);
+                    if ( row != NULL && abs(c) < fd->T && v == fd->maxiter ) {
+                        row[k].idx = idx;
+                        row[k].n = n;
+                        row[k].pad = 0;
+                        row[k].re = Z.real();
+                        row[k].im = Z.imag();
+                        k++;
+                    }
+                }
+                if ( k > 0 ) {
+#pragma omp critical (orbit_list)
+                    if ( list_append(&list, row, k) )
+                        failed = 1;
+                }
+            }
+            free(row);
+        }
+
+        st = list.st;
+        count = list.count;
+        /* rows came in any order, the file keeps them in the order of the picture */
+        if ( ! failed )
+            qsort(st, count, sizeof(orbit_state), by_idx);
+    }
+
+    if ( failed )
+        printf("Error: Not enough memory for the bounded points, %s is not written\n", file);
+    else {
+        printf("[Orbit]->Points still bounded: %llu\n", (unsigned long long)count);
+        save_state(fd, file, st, count);
+    }
+
+    free(st);
+
+    return 0;
+}
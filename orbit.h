@@ -0,0 +1,15 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef ORBITH
+#define ORBITH
+
+#include "mandelbrot_set.h"
+
+extern int orbit_render(fdata*, const char* file);
+
+#endif
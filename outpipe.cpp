@@ -0,0 +1,452 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Zapis w tle
+ * Asynchronous output pipeline: the PPM file is written while rendering
+ *
+ * The file is cut into blocks of OP_BLOCK bytes. A thread of the pipeline
+ * watches the finished rows (fdata.rowdone) and as soon as all rows of a
+ * block are there, colours the block into a buffer of its own and submits
+ * it; OP_BUFS blocks may be in flight. Blocks are written at their offsets
+ * in whatever order they are finished, so the disk works while the workers
+ * do and only the blocks of the last rows are left after the render.
+ *
+ * Writes go through io_uring, set up with raw system calls, or when it is
+ * not there (old kernel, seccomp) straight from the thread with pwrite.
+ * The file is opened with O_DIRECT if its file system allows it; then the
+ * header is padded with a comment to OP_ALIGN bytes so that every block
+ * starts aligned, and the last one is written whole and cut afterwards.
+ * Otherwise the file is byte for byte the one of write_ppm.
+ *
+ * Colours have to be known before the render, so the pipeline takes only
+ * a fixed colour table (no histogram equalization).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "mandelbrot_set.h"
+#include "outpipe.h"
+
+#define OP_BLOCK	(1 << 20)	/* bytes of the file coloured and written at once */
+#define OP_ALIGN	4096	/* O_DIRECT alignment of offsets, lengths and buffers */
+#define OP_BUFS		8	/* blocks in flight */
+#define OP_POLL_NS	1000000	/* between looks at the rows */
+
+struct outpipe {
+    fdata* fd;
+    rgb_t* lut;		/* colour_size entries */
+    char* rowdone;		/* allocated here when the render had none, NULL otherwise */
+    int file;
+    int direct;		/* opened with O_DIRECT */
+    char header[OP_ALIGN];
+    size_t hdr, size;	/* bytes of the header and of the whole file */
+    long nblocks;
+    char* sent;		/* blocks submitted */
+    long early;		/* of them while the render was running */
+    int finish;		/* set when all rows are done */
+    int failed;
+    int started;		/* whether the thread runs */
+    pthread_t thread;
+
+    unsigned char* buf[OP_BUFS];
+    struct iovec iov[OP_BUFS];
+    int busy[OP_BUFS];
+
+    /* io_uring, ring < 0 if writes go through pwrite */
+    int ring;
+    unsigned sq_mask, cq_mask;
+    unsigned *sq_head, *sq_tail, *sq_array, *cq_head, *cq_tail;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqe_len;
+};
+
+///////////////////////////////////////
+
+static int
+ring_setup(outpipe* op)
+    /* io_uring of OP_BUFS entries, 1 if there is none */
+{
+    struct io_uring_params p;
+    int single;
+
+    memset(&p, 0, sizeof(p));
+    op->ring = syscall(__NR_io_uring_setup, OP_BUFS, &p);
+    if ( op->ring < 0 )
+        return 1;
+
+    op->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    op->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if ( single && op->cq_len > op->sq_len )
+        op->sq_len = op->cq_len;
+
+    op->sq_map = mmap(NULL, op->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, op->ring, IORING_OFF_SQ_RING);
+    op->cq_map = single ? op->sq_map
+        : mmap(NULL, op->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, op->ring, IORING_OFF_CQ_RING);
+    op->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    op->sqes = (struct io_uring_sqe*)mmap(NULL, op->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            op->ring, IORING_OFF_SQES);
+    if ( op->sq_map == MAP_FAILED || op->cq_map == MAP_FAILED || op->sqes == MAP_FAILED ) {
+        if ( op->sqes != MAP_FAILED )
+            munmap(op->sqes, op->sqe_len);
+        if ( op->cq_map != MAP_FAILED && op->cq_map != op->sq_map )
+            munmap(op->cq_map, op->cq_len);
+        if ( op->sq_map != MAP_FAILED )
+            munmap(op->sq_map, op->sq_len);
+        close(op->ring);
+        op->ring = -1;
+        return 1;
+    }
+
+    op->sq_head = (unsigned*)((char*)op->sq_map + p.sq_off.head);
+    op->sq_tail = (unsigned*)((char*)op->sq_map + p.sq_off.tail);
+    op->sq_mask = *(unsigned*)((char*)op->sq_map + p.sq_off.ring_mask);
+    op->sq_array = (unsigned*)((char*)op->sq_map + p.sq_off.array);
+    op->cq_head = (unsigned*)((char*)op->cq_map + p.cq_off.head);
+    op->cq_tail = (unsigned*)((char*)op->cq_map + p.cq_off.tail);
+    op->cq_mask = *(unsigned*)((char*)op->cq_map + p.cq_off.ring_mask);
+    op->cqes = (struct io_uring_cqe*)((char*)op->cq_map + p.cq_off.cqes);
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static void
+ring_close(outpipe* op)
+{
+    if ( op->ring < 0 )
+        return;
+    munmap(op->sqes, op->sqe_len);
+    if ( op->cq_map != op->sq_map )
+        munmap(op->cq_map, op->cq_len);
+    munmap(op->sq_map, op->sq_len);
+    close(op->ring);
+}
+
+///////////////////////////////////////
+
+static void
+reap(outpipe* op, int wait)
+    /* frees the buffers of the finished writes; with wait, at least one */
+{
+    unsigned head, tail;
+    struct io_uring_cqe* c;
+
+    if ( wait )
+        syscall(__NR_io_uring_enter, op->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+    head = *op->cq_head;
+    tail = __atomic_load_n(op->cq_tail, __ATOMIC_ACQUIRE);
+    for ( ; head != tail; head++ ) {
+        c = &op->cqes[head & op->cq_mask];
+        if ( c->res != (int)op->iov[c->user_data].iov_len ) {
+            fprintf(stderr, "[Output]->write: %s\n", ( c->res < 0 ) ? strerror(-c->res) : "short write");
+            op->failed = 1;
+        }
+        op->busy[c->user_data] = 0;
+    }
+    __atomic_store_n(op->cq_head, head, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////
+
+static int
+free_buffer(outpipe* op)
+    /* a buffer of no write in flight, waiting for one if need be */
+{
+    int i;
+
+    for (;;) {
+        for ( i = 0; i < OP_BUFS; i++ )
+            if ( ! op->busy[i] )
+                return i;
+        reap(op, 1);
+    }
+}
+
+///////////////////////////////////////
+
+static void
+submit(outpipe* op, int i, off_t off)
+    /* writes buffer i at off */
+{
+    unsigned tail, idx;
+    struct io_uring_sqe* s;
+
+    if ( op->ring < 0 ) {
+        if ( pwrite(op->file, op->iov[i].iov_base, op->iov[i].iov_len, off) != (ssize_t)op->iov[i].iov_len ) {
+            perror("[Output]->pwrite");
+            op->failed = 1;
+        }
+        return;
+    }
+
+    tail = *op->sq_tail;
+    idx = tail & op->sq_mask;
+    s = &op->sqes[idx];
+    memset(s, 0, sizeof(*s));
+    s->opcode = IORING_OP_WRITEV;
+    s->fd = op->file;
+    s->addr = (unsigned long)&op->iov[i];
+    s->len = 1;
+    s->off = off;
+    s->user_data = i;
+    op->sq_array[idx] = idx;
+    __atomic_store_n(op->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    op->busy[i] = 1;
+
+    if ( syscall(__NR_io_uring_enter, op->ring, 1, 0, 0, NULL, 0) < 0 ) {
+        perror("[Output]->io_uring_enter");
+        op->busy[i] = 0;
+        op->failed = 1;
+    }
+}
+
+///////////////////////////////////////
+
+static int
+block_ready(const outpipe* op, long b)
+    /* whether all rows of block b are done */
+{
+    const fdata* fd = op->fd;
+    size_t rowlen = (size_t)fd->resolution * 3;
+    size_t lo = (size_t)b * OP_BLOCK, hi = lo + OP_BLOCK;
+    long r, r0, r1;
+
+    /* rows of the picture in the block, the top one first in the file */
+    lo = ( lo > op->hdr ) ? lo - op->hdr : 0;
+    hi = ( hi > op->hdr ) ? hi - op->hdr : 0;
+    if ( hi > rowlen * fd->resolution )
+        hi = rowlen * fd->resolution;
+    if ( hi <= lo )
+        return 1;
+    r0 = lo / rowlen;
+    r1 = (hi - 1) / rowlen;
+    for ( r = r0; r <= r1; r++ )
+        if ( ! row_is_done(fd, fd->resolution - 1 - r) )
+            return 0;
+
+    return 1;
+}
+
+///////////////////////////////////////
+
+static size_t
+fill_block(const outpipe* op, long b, unsigned char* out)
+    /* the bytes of block b, returns how many are to be written */
+{
+    const fdata* fd = op->fd;
+    size_t n = fd->resolution, rowlen = n * 3, pix = rowlen * n;
+    size_t lo = (size_t)b * OP_BLOCK, hi = lo + OP_BLOCK, p, len;
+
+    if ( hi > op->size )
+        hi = op->size;
+    len = hi - lo;
+
+    for ( p = lo; p < hi; p++ ) {
+        if ( p < op->hdr )
+            *out++ = op->header[p];
+        else if ( p - op->hdr < pix ) {
+            /* the rest of the row at once */
+            size_t q = p - op->hdr, x = (q % rowlen) / 3, c = q % 3;
+            int y = n - 1 - q / rowlen;
+
+            for ( ; x < n && p < hi; x++, c = 0 )
+                for ( ; c < 3 && p < hi; c++, p++ )
+                    *out++ = op->lut[colour_at(fd, x, y)][c];
+            p--;
+        } else
+            *out++ = '\n';
+    }
+
+    /* O_DIRECT writes whole sectors; the file is cut to its size at the end */
+    if ( op->direct && len % OP_ALIGN ) {
+        memset(out, 0, OP_ALIGN - len % OP_ALIGN);
+        len += OP_ALIGN - len % OP_ALIGN;
+    }
+
+    return len;
+}
+
+///////////////////////////////////////
+
+static void*
+pipeline(void* arg)
+{
+    outpipe* op = (outpipe*)arg;
+    struct timespec ts = { 0, OP_POLL_NS };
+    long b, left = op->nblocks;
+    int i, last;
+
+    while ( left > 0 && ! __atomic_load_n(&op->failed, __ATOMIC_RELAXED) ) {
+        /* all rows are done once finish is seen, so this pass sends the rest */
+        last = __atomic_load_n(&op->finish, __ATOMIC_ACQUIRE);
+        for ( b = 0; b < op->nblocks; b++ ) {
+            if ( op->sent[b] || ! block_ready(op, b) )
+                continue;
+            i = free_buffer(op);
+            op->iov[i].iov_len = fill_block(op, b, op->buf[i]);
+            submit(op, i, (off_t)b * OP_BLOCK);
+            op->sent[b] = 1;
+            op->early += ! last;
+            left--;
+        }
+        if ( left > 0 )
+            nanosleep(&ts, NULL);
+    }
+
+    /* the writes in flight */
+    if ( op->ring >= 0 )
+        for ( i = 0; i < OP_BUFS; i++ )
+            while ( op->busy[i] )
+                reap(op, 1);
+
+    return NULL;
+}
+
+///////////////////////////////////////
+outpipe*
+outpipe_start(fdata* fd, const rgb_t* lut, const char* filename)
+{
+    outpipe* op = (outpipe*)calloc(1, sizeof(outpipe));
+    char dims[64];
+    size_t pad;
+    int i;
+
+#ifdef DEBUG
+    printf("[Output]->outpipe_start: %s\n", filename);
+#endif
+
+    if ( op == NULL )
+        return NULL;
+    op->fd = fd;
+    op->ring = -1;
+    op->lut = (rgb_t*)malloc(colour_size(fd) * sizeof(rgb_t));
+    if ( op->lut == NULL ) {
+        printf("Error: Not enough memory for the output pipeline\n");
+        free(op);
+        return NULL;
+    }
+    memcpy(op->lut, lut, colour_size(fd) * sizeof(rgb_t));
+
+    op->file = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    op->direct = op->file >= 0;
+    if ( op->file < 0 )
+        op->file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( op->file < 0 ) {
+        perror("[Output]->outpipe_start");
+        free(op->lut);
+        free(op);
+        return NULL;
+    }
+
+    /* the header of write_ppm, padded with a comment to a whole sector for O_DIRECT */
+    snprintf(dims, sizeof(dims), "%d %d\n%d\n", fd->resolution, fd->resolution, 255);
+    if ( op->direct ) {
+        pad = OP_ALIGN - 3 - strlen(dims);
+        memcpy(op->header, "P6\n", 3);
+        memset(op->header + 3, ' ', pad);
+        op->header[3] = '#';
+        op->header[3 + pad - 1] = '\n';
+        memcpy(op->header + 3 + pad, dims, strlen(dims));
+        op->hdr = OP_ALIGN;
+    } else
+        op->hdr = snprintf(op->header, sizeof(op->header), "P6\n%s", dims);
+    op->size = op->hdr + (size_t)fd->resolution * fd->resolution * 3 + 1;
+    op->nblocks = (op->size + OP_BLOCK - 1) / OP_BLOCK;
+
+    op->sent = (char*)calloc(op->nblocks, sizeof(char));
+    for ( i = 0; i < OP_BUFS; i++ ) {
+        if ( posix_memalign((void**)&op->buf[i], OP_ALIGN, OP_BLOCK) )
+            op->buf[i] = NULL;
+        op->iov[i].iov_base = op->buf[i];
+    }
+    if ( fd->rowdone == NULL )
+        fd->rowdone = op->rowdone = (char*)calloc(fd->resolution, sizeof(char));
+    for ( i = 0; i < OP_BUFS && op->buf[i] != NULL; i++ )
+        ;
+    if ( op->sent == NULL || i < OP_BUFS || fd->rowdone == NULL ) {
+        printf("Error: Not enough memory for the output pipeline\n");
+        op->failed = 1;
+        outpipe_finish(op, 0);
+        return NULL;
+    }
+
+    if ( ring_setup(op) )
+        printf("[Output]->io_uring unavailable (%s), writing from a thread\n", strerror(errno));
+    printf("[Output]->%s, %s, %ld blocks of %d KB\n", filename, op->direct ? "O_DIRECT" : "buffered",
+            op->nblocks, OP_BLOCK / 1024);
+
+    if ( pthread_create(&op->thread, NULL, pipeline, op) ) {
+        perror("[Output]->pthread_create");
+        op->failed = 1;
+        outpipe_finish(op, 0);
+        return NULL;
+    }
+    op->started = 1;
+
+    return op;
+}
+
+///////////////////////////////////////
+int
+outpipe_finish(outpipe* op, int complete)
+    /* with complete all rows have to be done by now, the rest is written; otherwise the render failed and it is not */
+{
+    int i, failed;
+
+#ifdef DEBUG
+    printf("[Output]->outpipe_finish\n");
+#endif
+
+    if ( ! complete )
+        __atomic_store_n(&op->failed, 1, __ATOMIC_RELAXED);
+    if ( op->started ) {
+        __atomic_store_n(&op->finish, 1, __ATOMIC_RELEASE);
+        pthread_join(op->thread, NULL);
+        printf("[Output]->%ld of %ld blocks written %s during the render\n", op->early, op->nblocks,
+                ( op->ring >= 0 ) ? "through io_uring" : "by the thread");
+    }
+
+    if ( op->direct && ! op->failed && ftruncate(op->file, op->size) ) {
+        perror("[Output]->ftruncate");
+        op->failed = 1;
+    }
+    if ( close(op->file) ) {
+        perror("[Output]->close");
+        op->failed = 1;
+    }
+    ring_close(op);
+
+    if ( op->rowdone != NULL ) {
+        op->fd->rowdone = NULL;
+        free(op->rowdone);
+    }
+    for ( i = 0; i < OP_BUFS; i++ )
+        free(op->buf[i]);
+    free(op->sent);
+    free(op->lut);
+    failed = op->failed;
+    free(op);
+
+    return failed;
+}
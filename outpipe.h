@@ -0,0 +1,19 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef OUTPIPEH
+#define OUTPIPEH
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+typedef struct outpipe outpipe;
+
+extern outpipe* outpipe_start(fdata*, const rgb_t* lut, const char* filename);
+extern int outpipe_finish(outpipe*, int complete);
+
+#endif
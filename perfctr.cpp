@@ -0,0 +1,293 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Liczniki sprzetowe
+ * Hardware performance counters
+ *
+ * Counters of perf_event_open(2), without any tools. A phase (allocate,
+ * compute, colour, write) opens them for every thread of the process with
+ * inherit set, so threads started during the phase count too; the OpenMP
+ * team is started beforehand for the same reason. A worker thread opens
+ * counters of its own between perf_thread_begin and perf_thread_end.
+ *
+ * Counters which cannot be opened (no PMU in a virtual machine, the
+ * perf_event_paranoid setting) are reported as n/a, the rest still work.
+ * Counts of multiplexed counters are scaled by the time they ran.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+
+#include "perfctr.h"
+
+#define PERF_EVENTS	5
+#define PERF_TASKS	256	/* most threads counted in a phase */
+#define PERF_PHASES	16
+#define PERF_THREADS	1024	/* most worker records */
+
+static const struct {
+    const char* name;
+    unsigned type;
+    unsigned long long config;
+} events[PERF_EVENTS] = {
+    { "cycles",		PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-misses",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_CACHE_MISSES },
+    { "branch-misses",	PERF_TYPE_HARDWARE,	PERF_COUNT_HW_BRANCH_MISSES },
+    { "ctx-switches",	PERF_TYPE_SOFTWARE,	PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* counts of one phase or one thread, -1 - not available */
+typedef struct {
+    char who[32];
+    long long v[PERF_EVENTS];
+} record;
+
+static int enabled;
+static int user_only;	/* the kernel allows counting user space only */
+static int reason;	/* errno of the first counter which could not be opened */
+
+static const char* phase;	/* phase in progress, NULL if none */
+static int pfd[PERF_TASKS][PERF_EVENTS];
+static int ntasks;
+
+static record phases[PERF_PHASES];
+static int nphases;
+static record threads[PERF_THREADS];
+static int nthreads;
+static pthread_mutex_t tlock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int tfd[PERF_EVENTS];
+
+///////////////////////////////////////
+
+static int
+open_event(int e, pid_t tid, int inherit)
+    /* counter e of thread tid, -1 if it cannot be had */
+{
+    struct perf_event_attr pe;
+    int fd;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = events[e].type;
+    pe.config = events[e].config;
+    pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    pe.inherit = inherit;
+    pe.exclude_hv = 1;
+    pe.exclude_kernel = user_only;
+
+    fd = syscall(__NR_perf_event_open, &pe, tid, -1, -1, 0);
+    if ( fd < 0 && errno == EACCES && ! user_only ) {
+        /* perf_event_paranoid 2 and more: user space only */
+        pe.exclude_kernel = 1;
+        if ( (fd = syscall(__NR_perf_event_open, &pe, tid, -1, -1, 0)) >= 0 )
+            user_only = 1;
+    }
+    if ( fd < 0 && reason == 0 )
+        reason = errno;
+
+    return fd;
+}
+
+///////////////////////////////////////
+
+static long long
+read_event(int fd)
+    /* the count scaled by the time the counter was scheduled, -1 if there is none */
+{
+    unsigned long long r[3];	/* value, time enabled, time running */
+
+    if ( fd < 0 || read(fd, r, sizeof(r)) != sizeof(r) )
+        return -1;
+    if ( r[2] == 0 )
+        return ( r[1] == 0 ) ? 0 : -1;
+    if ( r[2] < r[1] )
+        return (long long)((double)r[0] * r[1] / r[2]);
+
+    return (long long)r[0];
+}
+
+///////////////////////////////////////
+
+static void
+add(long long* sum, long long v)
+{
+    if ( v < 0 )
+        return;
+    *sum = ( *sum < 0 ) ? v : *sum + v;
+}
+
+///////////////////////////////////////
+int
+perf_init(int num_proc)
+{
+    int e, fd, found = 0;
+
+#ifdef DEBUG
+    printf("[Perf]->perf_init\n");
+#endif
+
+    /* one probe for every event tells whether there is anything to count */
+    for ( e = 0; e < PERF_EVENTS; e++ )
+        if ( (fd = open_event(e, 0, 0)) >= 0 ) {
+            close(fd);
+            found++;
+        }
+    if ( found == 0 ) {
+        printf("[Perf]->Counters unavailable: %s (see /proc/sys/kernel/perf_event_paranoid)\n", strerror(reason));
+        return 1;
+    }
+    if ( found < PERF_EVENTS )
+        printf("[Perf]->Only %d of %d counters available: %s\n", found, PERF_EVENTS, strerror(reason));
+    if ( user_only )
+        printf("[Perf]->Counting user space only\n");
+
+    /* the OpenMP team exists before the first phase, so the phases see its threads */
+    omp_set_num_threads(num_proc);
+#pragma omp parallel
+    {
+    }
+
+    enabled = 1;
+    return 0;
+}
+
+///////////////////////////////////////
+void
+perf_phase_begin(const char* name)
+{
+    DIR* dir;
+    struct dirent* de;
+    int e;
+
+    if ( ! enabled || nphases == PERF_PHASES )
+        return;
+
+    ntasks = 0;
+    if ( (dir = opendir("/proc/self/task")) == NULL )
+        return;
+    while ( (de = readdir(dir)) != NULL && ntasks < PERF_TASKS ) {
+        if ( de->d_name[0] == '.' )
+            continue;
+        for ( e = 0; e < PERF_EVENTS; e++ )
+            pfd[ntasks][e] = open_event(e, atoi(de->d_name), 1);
+        ntasks++;
+    }
+    closedir(dir);
+
+    phase = name;
+}
+
+///////////////////////////////////////
+void
+perf_phase_end()
+{
+    record* r;
+    int e, t;
+
+    if ( phase == NULL )
+        return;
+
+    r = &phases[nphases++];
+    snprintf(r->who, sizeof(r->who), "%s", phase);
+    for ( e = 0; e < PERF_EVENTS; e++ ) {
+        r->v[e] = -1;
+        for ( t = 0; t < ntasks; t++ ) {
+            add(&r->v[e], read_event(pfd[t][e]));
+            if ( pfd[t][e] >= 0 )
+                close(pfd[t][e]);
+        }
+    }
+
+    phase = NULL;
+}
+
+///////////////////////////////////////
+void
+perf_thread_begin()
+    /* counters of the calling thread, counted only during a phase */
+{
+    int e;
+
+    for ( e = 0; e < PERF_EVENTS; e++ )
+        tfd[e] = ( enabled && phase != NULL ) ? open_event(e, 0, 0) : -1;
+}
+
+///////////////////////////////////////
+void
+perf_thread_end(const char* who, int id)
+{
+    record r;
+    int e, any = 0;
+
+    for ( e = 0; e < PERF_EVENTS; e++ ) {
+        r.v[e] = read_event(tfd[e]);
+        if ( tfd[e] >= 0 ) {
+            close(tfd[e]);
+            tfd[e] = -1;
+            any = 1;
+        }
+    }
+    if ( ! any )
+        return;
+    snprintf(r.who, sizeof(r.who), "%s-%d", who, id);
+
+    pthread_mutex_lock(&tlock);
+    if ( nthreads < PERF_THREADS )
+        threads[nthreads++] = r;
+    pthread_mutex_unlock(&tlock);
+}
+
+///////////////////////////////////////
+
+static void
+print_record(const record* r)
+{
+    int e;
+
+    printf("[Perf]->%-14s", r->who);
+    for ( e = 0; e < PERF_EVENTS; e++ )
+        if ( r->v[e] < 0 )
+            printf(" %14s", "n/a");
+        else
+            printf(" %14lld", r->v[e]);
+    if ( r->v[0] > 0 && r->v[1] >= 0 )
+        printf(" %6.2f\n", (double)r->v[1] / r->v[0]);
+    else
+        printf(" %6s\n", "n/a");
+}
+
+///////////////////////////////////////
+void
+perf_report()
+{
+    int e, i;
+
+    if ( ! enabled )
+        return;
+
+    printf("[Perf]->%-14s", "");
+    for ( e = 0; e < PERF_EVENTS; e++ )
+        printf(" %14s", events[e].name);
+    printf(" %6s\n", "IPC");
+
+    for ( i = 0; i < nphases; i++ )
+        print_record(&phases[i]);
+    for ( i = 0; i < nthreads; i++ )
+        print_record(&threads[i]);
+}
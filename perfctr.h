@@ -0,0 +1,18 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef PERFCTRH
+#define PERFCTRH
+
+extern int perf_init(int num_proc);
+extern void perf_phase_begin(const char* name);
+extern void perf_phase_end();
+extern void perf_thread_begin();
+extern void perf_thread_end(const char* who, int id);
+extern void perf_report();
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Zapis PNG
+ * PNG writer with parallel deflate, without zlib
+ *
+ * The picture is either the coloured one (rgb), or the table itself: the
+ * iteration counts are indices into a palette made of the colour table
+ * (palette) or grey levels (gray), one byte per pixel.
+ *
+ * The rows are cut into chunks of about PNG_CHUNK bytes which threads
+ * deflate independently, as pigz does: LZ77 on a hash chain and the fixed
+ * Huffman codes, which suit the long runs of equal counts. A chunk other
+ * than the last one ends with an empty stored block, so it ends on a byte
+ * boundary and the chunks are simply joined into one zlib stream; their
+ * Adler-32 sums are combined. Every chunk is an IDAT of its own.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "png.h"
+
+#define PNG_CHUNK	(256 * 1024)	/* bytes of rows deflated by one thread at once */
+#define LZ_WINDOW	32768
+#define LZ_HASH		(1 << 15)
+#define LZ_CHAIN	32	/* candidates tried for a match */
+#define LZ_MIN		3
+#define LZ_MAX		258
+#define LZ_INSERT	32	/* longer matches are not put into the hash chain */
+#define ADLER_BASE	65521
+
+static const char* modes[] = { "rgb", "palette", "gray" };
+
+/* a deflated chunk */
+typedef struct {
+    unsigned char* buf;
+    size_t len, cap;
+    uint64_t bits;	/* bits not written yet, the first one lowest */
+    int nbits;
+    uint32_t adler;	/* of the raw bytes */
+    size_t raw;	/* their number */
+} stream;
+
+static uint32_t crc_table[256];
+static uint16_t lit_code[288];	/* fixed codes of literals/lengths, reversed to go out the lowest bit first */
+static uint8_t lit_bits[288];
+
+/* length codes 257... and distance codes of deflate (RFC 1951 3.2.5) */
+static const int len_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int len_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+///////////////////////////////////////
+int
+png_mode(const char* name)
+    /* PNG_* of the name, -1 if unknown */
+{
+    int m;
+
+    for ( m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++ )
+        if ( ! strcmp(name, modes[m]) )
+            return m;
+
+    return -1;
+}
+
+///////////////////////////////////////
+
+static inline uint32_t
+reverse(uint32_t code, int n)
+    /* Huffman codes go the highest bit first */
+{
+    uint32_t r = 0;
+    int i;
+
+    for ( i = 0; i < n; i++ )
+        r |= ((code >> i) & 1) << (n - 1 - i);
+
+    return r;
+}
+
+static void
+tables_init()
+{
+    uint32_t c;
+    int n, k;
+
+    for ( n = 0; n < 256; n++ ) {
+        c = n;
+        for ( k = 0; k < 8; k++ )
+            c = ( c & 1 ) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+
+    /* RFC 1951 3.2.6 */
+    for ( n = 0; n < 288; n++ ) {
+        if ( n < 144 )
+            lit_bits[n] = 8, c = 0x30 + n;
+        else if ( n < 256 )
+            lit_bits[n] = 9, c = 0x190 + n - 144;
+        else if ( n < 280 )
+            lit_bits[n] = 7, c = n - 256;
+        else
+            lit_bits[n] = 8, c = 0xc0 + n - 280;
+        lit_code[n] = reverse(c, lit_bits[n]);
+    }
+}
+
+static uint32_t
+crc(uint32_t c, const unsigned char* p, size_t n)
+    /* c - CRC of the bytes before, 0 at first */
+{
+    c ^= 0xffffffffU;
+    while ( n-- )
+        c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+
+    return c ^ 0xffffffffU;
+}
+
+///////////////////////////////////////
+
+static uint32_t
+adler(const unsigned char* p, size_t n)
+{
+    uint32_t a = 1, b = 0;
+    size_t k;
+
+    while ( n > 0 ) {
+        /* 5552 bytes cannot overflow b */
+        k = ( n < 5552 ) ? n : 5552;
+        n -= k;
+        while ( k-- ) {
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+static uint32_t
+adler_combine(uint32_t a1, uint32_t a2, size_t len2)
+    /* Adler-32 of two byte strings joined, from the sums of each and the length of the second */
+{
+    uint32_t rem = len2 % ADLER_BASE;
+    uint32_t s1 = a1 & 0xffff;
+    uint32_t s2 = (uint32_t)(((uint64_t)rem * s1) % ADLER_BASE);
+
+    s1 += (a2 & 0xffff) + ADLER_BASE - 1;
+    s2 += (a1 >> 16) + (a2 >> 16) + ADLER_BASE - rem;
+    if ( s1 >= ADLER_BASE )
+        s1 -= ADLER_BASE;
+    if ( s1 >= ADLER_BASE )
+        s1 -= ADLER_BASE;
+    if ( s2 >= 2 * ADLER_BASE )
+        s2 -= 2 * ADLER_BASE;
+    if ( s2 >= ADLER_BASE )
+        s2 -= ADLER_BASE;
+
+    return (s2 << 16) | s1;
+}
+
+///////////////////////////////////////
+
+static inline void
+put_bits(stream* s, uint32_t v, int n)
+    /* n bits of v, the lowest first */
+{
+    s->bits |= (uint64_t)v << s->nbits;
+    s->nbits += n;
+    while ( s->nbits >= 8 ) {
+        s->buf[s->len++] = (unsigned char)s->bits;
+        s->bits >>= 8;
+        s->nbits -= 8;
+    }
+}
+
+static inline void
+put_literal(stream* s, int c)
+    /* the fixed code of literal/length c */
+{
+    put_bits(s, lit_code[c], lit_bits[c]);
+}
+
+static void
+put_match(stream* s, int len, int dist)
+{
+    int c;
+
+    for ( c = 28; len_base[c] > len; c-- )
+        ;
+    put_literal(s, 257 + c);
+    put_bits(s, len - len_base[c], len_extra[c]);
+
+    for ( c = 29; dist_base[c] > dist; c-- )
+        ;
+    put_bits(s, reverse(c, 5), 5);
+    put_bits(s, dist - dist_base[c], dist_extra[c]);
+}
+
+///////////////////////////////////////
+
+static inline unsigned
+hash3(const unsigned char* p)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (LZ_HASH - 1);
+}
+
+static int
+deflate_chunk(stream* s, const unsigned char* in, size_t n, int last)
+    /* one fixed Huffman block of n bytes; the last one is final, the others end on a byte */
+{
+    int* head = (int*)malloc(LZ_HASH * sizeof(int));
+    int* prev = (int*)malloc(LZ_WINDOW * sizeof(int));
+    size_t i, k;
+    int cand, chain, len, best, dist, j;
+
+    /* 9 bits per literal at most, and the ends of the blocks */
+    s->cap = n + n / 8 + 64;
+    s->buf = (unsigned char*)malloc(s->cap);
+    if ( head == NULL || prev == NULL || s->buf == NULL ) {
+        free(head);
+        free(prev);
+        return 1;
+    }
+    s->len = 0;
+    s->bits = 0;
+    s->nbits = 0;
+    s->adler = adler(in, n);
+    s->raw = n;
+    for ( j = 0; j < LZ_HASH; j++ )
+        head[j] = -1;
+
+    put_bits(s, last ? 1 : 0, 1);	/* BFINAL */
+    put_bits(s, 1, 2);		/* BTYPE fixed */
+
+    for ( i = 0; i < n; ) {
+        best = 0;
+        dist = 0;
+        if ( i + LZ_MIN <= n ) {
+            unsigned h = hash3(in + i);
+
+            /* the longest of the last LZ_CHAIN matches within the window */
+            for ( cand = head[h], chain = 0; cand >= 0 && i - cand <= LZ_WINDOW && chain < LZ_CHAIN;
+                    cand = prev[cand % LZ_WINDOW], chain++ ) {
+                for ( len = 0; len < LZ_MAX && i + len < n && in[cand + len] == in[i + len]; len++ )
+                    ;
+                if ( len > best ) {
+                    best = len;
+                    dist = i - cand;
+                    if ( len == LZ_MAX )
+                        break;
+                }
+            }
+            prev[i % LZ_WINDOW] = head[h];
+            head[h] = i;
+        }
+
+        if ( best >= LZ_MIN ) {
+            put_match(s, best, dist);
+            /* a long match is most likely a run, whose positions would only lengthen the chains */
+            if ( best <= LZ_INSERT )
+                for ( k = i + 1; k < i + best && k + LZ_MIN <= n; k++ ) {
+                    unsigned h = hash3(in + k);
+
+                    prev[k % LZ_WINDOW] = head[h];
+                    head[h] = k;
+                }
+            i += best;
+        } else
+            put_literal(s, in[i++]);
+    }
+    put_literal(s, 256);
+
+    if ( ! last ) {
+        /* an empty stored block: the chunk ends on a byte, the next one goes right after it */
+        put_bits(s, 0, 3);
+        put_bits(s, 0, (8 - s->nbits) & 7);
+        put_bits(s, 0x0000, 16);
+        put_bits(s, 0xffff, 16);
+    } else
+        put_bits(s, 0, (8 - s->nbits) & 7);
+
+    free(head);
+    free(prev);
+    return 0;
+}
+
+///////////////////////////////////////
+
+static void
+put32(unsigned char* p, uint32_t v)
+    /* PNG numbers are big-endian */
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int
+write_chunk(FILE* fp, const char* type, const unsigned char* data, size_t len)
+{
+    unsigned char b[8];
+    uint32_t c;
+
+    put32(b, len);
+    memcpy(b + 4, type, 4);
+    c = crc(crc(0, b + 4, 4), data, len);
+    if ( fwrite(b, 1, 8, fp) != 8 || (len > 0 && fwrite(data, 1, len, fp) != len) )
+        return 1;
+    put32(b, c);
+
+    return fwrite(b, 1, 4, fp) != 4;
+}
+
+///////////////////////////////////////
+int
+write_png(const fdata* fd, const unsigned char* rgb, const rgb_t* lut, int mode, const char* filename)
+    /* rgb - the coloured picture (PNG_RGB), lut - the colours of the counts (PNG_PALETTE) */
+{
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    int n = fd->resolution, bpp = ( mode == PNG_RGB ) ? 3 : 1;
+    size_t stride = (size_t)n * bpp + 1;	/* the filter byte and the pixels of a row */
+    int rows = ( PNG_CHUNK / stride > 0 ) ? PNG_CHUNK / stride : 1;
+    int nchunks = (n + rows - 1) / rows, c, failed = 0;
+    unsigned char hdr[13], zhead[2] = { 0x78, 0x01 }, tail[4], plte[3 * LUT_SIZE];
+    uint32_t sum;
+    stream* chunks;
+    FILE* fp;
+
+#ifdef DEBUG
+    printf("[PNG]->write_png: %s, %s, %d chunks\n", filename, modes[mode], nchunks);
+#endif
+
+    if ( (fp = fopen(filename, "wb")) == NULL ) {
+        perror("[PNG]->write_png");
+        return 1;
+    }
+    if ( (chunks = (stream*)calloc(nchunks, sizeof(stream))) == NULL ) {
+        printf("Error: Not enough memory for the PNG file\n");
+        fclose(fp);
+        return 1;
+    }
+    tables_init();
+
+    omp_set_num_threads(fd->num_proc);
+#pragma omp parallel for default(none) shared(fd, rgb, chunks, nchunks, n, rows, stride, bpp) reduction(+:failed) schedule(dynamic)
+    for ( c = 0; c < nchunks; c++ ) {
+        int y0 = c * rows, y1 = ( y0 + rows < n ) ? y0 + rows : n, y;
+        unsigned char* raw = (unsigned char*)malloc((y1 - y0) * stride);
+
+        if ( raw == NULL ) {
+            failed++;
+            continue;
+        }
+        for ( y = y0; y < y1; y++ ) {
+            unsigned char* r = raw + (y - y0) * stride;
+
+            /* filter none; the top row of the picture is the last one of the table */
+            r[0] = 0;
+            if ( bpp == 3 )
+                memcpy(r + 1, rgb + (size_t)y * n * 3, (size_t)n * 3);
+            else
+                memcpy(r + 1, fd->tab[n - 1 - y], n);
+        }
+        failed += deflate_chunk(&chunks[c], raw, (y1 - y0) * stride, c == nchunks - 1);
+        free(raw);
+    }
+
+    if ( ! failed ) {
+        put32(hdr, n);
+        put32(hdr + 4, n);
+        hdr[8] = 8;	/* bits per sample or index */
+        hdr[9] = ( mode == PNG_RGB ) ? 2 : ( mode == PNG_PALETTE ) ? 3 : 0;
+        hdr[10] = hdr[11] = hdr[12] = 0;	/* deflate, adaptive filters, no interlace */
+        failed |= fwrite(signature, 1, 8, fp) != 8;
+        failed |= write_chunk(fp, "IHDR", hdr, 13);
+        if ( mode == PNG_PALETTE ) {
+            memcpy(plte, lut, sizeof(plte));
+            failed |= write_chunk(fp, "PLTE", plte, sizeof(plte));
+        }
+
+        /* the zlib stream: its header, the chunks, the Adler-32 of all raw bytes */
+        failed |= write_chunk(fp, "IDAT", zhead, 2);
+        sum = chunks[0].adler;
+        for ( c = 0; c < nchunks; c++ ) {
+            failed |= write_chunk(fp, "IDAT", chunks[c].buf, chunks[c].len);
+            if ( c > 0 )
+                sum = adler_combine(sum, chunks[c].adler, chunks[c].raw);
+        }
+        put32(tail, sum);
+        failed |= write_chunk(fp, "IDAT", tail, 4);
+        failed |= write_chunk(fp, "IEND", NULL, 0);
+    } else
+        printf("Error: Not enough memory for the PNG file\n");
+
+    if ( fclose(fp) )
+        failed = 1;
+    if ( failed )
+        perror("[PNG]->write_png");
+    for ( c = 0; c < nchunks; c++ )
+        free(chunks[c].buf);
+    free(chunks);
+
+    return failed != 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef PNGH
+#define PNGH
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+/* pixels of the PNG file */
+enum { PNG_RGB = 0, PNG_PALETTE, PNG_GRAY };
+
+extern int png_mode(const char* name);
+extern int write_png(const fdata*, const unsigned char* rgb, const rgb_t* lut, int mode, const char* filename);
+
+#endif
@@ -0,0 +1,589 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Piramida obrazow
+ * Multi-resolution pyramid (mipmap) of the picture for tiled viewers
+ *
+ * Level 0 is the coloured picture itself, every next one is the previous
+ * one downsampled 2x by a box (2x2 average) or a Lanczos (a = 2) filter,
+ * down to the level fitting in one tile. Levels are cut into tiles,
+ * written as DIR/level/x_y.ppm, and DIR/pyramid.txt indexes them.
+ *
+ * The levels are made from the frame buffer in memory, so the picture is
+ * never read back from disk. A level is shrunk and written tile by tile
+ * in parallel; a tile of a level needs only the finished previous level.
+ *
+ * When the colours are known before the render (no histogram equalization)
+ * pyramid_start builds levels 0 and 1 while it runs: a thread polls the
+ * finished rows like the output pipeline does, and every band of tiles
+ * whose rows are done is coloured, written and shrunk in parallel. Only
+ * the small levels from 2 on are left for pyramid_finish.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "pyramid.h"
+
+#define PYR_A		2	/* lobes of the Lanczos filter */
+#define PYR_TAPS	(4 * PYR_A)	/* its taps on the source grid, twice as dense as the target one */
+#define PYR_PATH	4096
+#define PYR_POLL_NS	1000000	/* between looks at the rows */
+
+typedef struct {
+    int w, h;
+    unsigned char* rgb;
+} level;
+
+/* levels 0 and 1 built during the render */
+struct pyramid {
+    fdata* fd;
+    rgb_t* lut;		/* colour_size entries */
+    char* rowdone;		/* allocated here when the render had none, NULL otherwise */
+    const char* dir;
+    int tile, filter;
+    level l0, l1;		/* l1.h == 0 when level 0 fits in one tile */
+    int tx0, nb0, tx1, nb1;	/* tile columns and bands (rows of tiles) of both levels */
+    char *done0, *done1;	/* bands written */
+    int* ready;		/* bands of a pass */
+    long tiles;		/* of both levels */
+    long early;		/* of them while the render was running */
+    FILE* index;
+    int finish;		/* set when all rows are done */
+    int failed;
+    int started;		/* whether the thread runs */
+    pthread_t thread;
+};
+
+static const char* filters[] = { "box", "lanczos" };
+
+static double weight[PYR_TAPS];	/* Lanczos weights of source pixels 2x-PYR_A*2+1 ... 2x+PYR_A*2 */
+
+///////////////////////////////////////
+int
+pyramid_filter(const char* name)
+    /* PF_* of the name, -1 if unknown */
+{
+    int f;
+
+    for ( f = 0; f < (int)(sizeof(filters) / sizeof(filters[0])); f++ )
+        if ( ! strcmp(name, filters[f]) )
+            return f;
+
+    return -1;
+}
+
+///////////////////////////////////////
+
+static double
+sinc(double x)
+{
+    x *= M_PI;
+    return ( x == 0 ) ? 1 : sin(x) / x;
+}
+
+///////////////////////////////////////
+
+static void
+lanczos_init()
+    /* the source pixels lie (t - 3.5) / 2 target pixels from the middle of the target one */
+{
+    double d, sum = 0;
+    int t;
+
+    for ( t = 0; t < PYR_TAPS; t++ ) {
+        d = (t - (PYR_TAPS - 1) / 2.0) / 2;
+        weight[t] = sinc(d) * sinc(d / PYR_A);
+        sum += weight[t];
+    }
+    for ( t = 0; t < PYR_TAPS; t++ )
+        weight[t] /= sum;
+}
+
+///////////////////////////////////////
+
+static inline int
+clamp(int v, int lo, int hi)
+{
+    return ( v < lo ) ? lo : ( v > hi ) ? hi : v;
+}
+
+///////////////////////////////////////
+
+static void
+shrink(const level* src, level* dst, int x0, int y0, int x1, int y1, int filter)
+    /* pixels [x0, x1) x [y0, y1) of dst from src */
+{
+    const unsigned char* p;
+    double acc[3], w;
+    int x, y, a, b, c, sx, sy, sum[3], n;
+
+    for ( y = y0; y < y1; y++ )
+        for ( x = x0; x < x1; x++ ) {
+            unsigned char* o = dst->rgb + ((size_t)y * dst->w + x) * 3;
+
+            if ( filter == PF_BOX ) {
+                /* the last row or column of an odd level has no pair */
+                sum[0] = sum[1] = sum[2] = n = 0;
+                for ( sy = 2 * y; sy < 2 * y + 2 && sy < src->h; sy++ )
+                    for ( sx = 2 * x; sx < 2 * x + 2 && sx < src->w; sx++, n++ ) {
+                        p = src->rgb + ((size_t)sy * src->w + sx) * 3;
+                        for ( c = 0; c < 3; c++ )
+                            sum[c] += p[c];
+                    }
+                for ( c = 0; c < 3; c++ )
+                    o[c] = (sum[c] + n / 2) / n;
+            } else {
+                /* the edges are repeated */
+                acc[0] = acc[1] = acc[2] = 0;
+                for ( a = 0; a < PYR_TAPS; a++ ) {
+                    sy = clamp(2 * y - PYR_TAPS / 2 + 1 + a, 0, src->h - 1);
+                    for ( b = 0; b < PYR_TAPS; b++ ) {
+                        sx = clamp(2 * x - PYR_TAPS / 2 + 1 + b, 0, src->w - 1);
+                        p = src->rgb + ((size_t)sy * src->w + sx) * 3;
+                        w = weight[a] * weight[b];
+                        for ( c = 0; c < 3; c++ )
+                            acc[c] += w * p[c];
+                    }
+                }
+                for ( c = 0; c < 3; c++ )
+                    o[c] = clamp((int)lrint(acc[c]), 0, 255);
+            }
+        }
+}
+
+///////////////////////////////////////
+
+static int
+write_tile(const level* l, const char* dir, int lv, int x0, int y0, int x1, int y1, int tile)
+{
+    char path[PYR_PATH];
+    FILE* fp;
+    int y;
+
+    snprintf(path, sizeof(path), "%s/%d/%d_%d.ppm", dir, lv, x0 / tile, y0 / tile);
+    if ( (fp = fopen(path, "wb")) == NULL ) {
+        perror("[Pyramid]->write_tile");
+        return 1;
+    }
+    fprintf(fp, "P6\n%d %d\n%d\n", x1 - x0, y1 - y0, 255);
+    for ( y = y0; y < y1; y++ )
+        fwrite(l->rgb + ((size_t)y * l->w + x0) * 3, 3, x1 - x0, fp);
+    if ( fclose(fp) ) {
+        perror("[Pyramid]->write_tile");
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+make_dir(const char* path)
+{
+    if ( mkdir(path, 0755) && errno != EEXIST ) {
+        perror("[Pyramid]->make_dir");
+        return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static void
+index_level(FILE* fp, int lv, int w, int h, int tile, int filter)
+    /* the line of level lv in pyramid.txt */
+{
+    int tx = (w + tile - 1) / tile;
+
+    fprintf(fp, "%d %d %d %d %d %d %s\n", lv, w, h, tile, tx, (h + tile - 1) / tile, filters[filter]);
+}
+
+///////////////////////////////////////
+
+static int
+next_levels(FILE* fp, const char* dir, const level* top, int lv, int tile, int filter)
+    /*
+     * levels lv+1, ... from top, level lv written already, down to the one fitting in a tile;
+     * returns the number of the last level, -1 on failure
+     */
+{
+    char path[PYR_PATH];
+    level prev = *top, cur;
+    int t, tx, nt, failed = 0;
+
+    while ( prev.w > tile || prev.h > tile ) {
+        lv++;
+        cur.w = (prev.w + 1) / 2;
+        cur.h = (prev.h + 1) / 2;
+        if ( (cur.rgb = (unsigned char*)malloc((size_t)cur.w * cur.h * 3)) == NULL ) {
+            printf("Error: Not enough memory for level %d of the pyramid\n", lv);
+            failed = 1;
+            break;
+        }
+        snprintf(path, sizeof(path), "%s/%d", dir, lv);
+        if ( make_dir(path) ) {
+            free(cur.rgb);
+            failed = 1;
+            break;
+        }
+        index_level(fp, lv, cur.w, cur.h, tile, filter);
+        tx = (cur.w + tile - 1) / tile;
+        nt = tx * ((cur.h + tile - 1) / tile);
+
+#pragma omp parallel for default(none) shared(prev, cur, dir, tile, filter, tx, nt, lv) reduction(+:failed) schedule(dynamic)
+        for ( t = 0; t < nt; t++ ) {
+            int x0 = (t % tx) * tile, y0 = (t / tx) * tile;
+            int x1 = ( x0 + tile < cur.w ) ? x0 + tile : cur.w;
+            int y1 = ( y0 + tile < cur.h ) ? y0 + tile : cur.h;
+
+            shrink(&prev, &cur, x0, y0, x1, y1, filter);
+            failed += write_tile(&cur, dir, lv, x0, y0, x1, y1, tile);
+        }
+
+        if ( prev.rgb != top->rgb )
+            free(prev.rgb);
+        prev = cur;
+        if ( failed )
+            break;
+    }
+    if ( prev.rgb != top->rgb )
+        free(prev.rgb);
+
+    return failed ? -1 : lv;
+}
+
+///////////////////////////////////////
+
+static FILE*
+open_index(const char* dir)
+    /* the directory of the pyramid and its pyramid.txt */
+{
+    char path[PYR_PATH];
+    FILE* fp;
+
+    if ( make_dir(dir) )
+        return NULL;
+    snprintf(path, sizeof(path), "%s/pyramid.txt", dir);
+    if ( (fp = fopen(path, "w")) == NULL ) {
+        perror("[Pyramid]->open_index");
+        return NULL;
+    }
+    fprintf(fp, "# level width height tile columns rows filter\n");
+
+    return fp;
+}
+
+///////////////////////////////////////
+int
+pyramid_write(const fdata* fd, const unsigned char* rgb, const char* dir, int tile, int filter)
+    /* the pyramid of the coloured picture, all levels after the render */
+{
+    char path[PYR_PATH];
+    level top;
+    FILE* fp;
+    int t, tx, nt, lv, failed = 0;
+
+#ifdef DEBUG
+    printf("[Pyramid]->pyramid_write: %s, tiles of %d, %s filter\n", dir, tile, filters[filter]);
+#endif
+
+    if ( (fp = open_index(dir)) == NULL )
+        return 1;
+    if ( filter == PF_LANCZOS )
+        lanczos_init();
+    omp_set_num_threads(fd->num_proc);
+
+    top.w = top.h = fd->resolution;
+    top.rgb = (unsigned char*)rgb;
+    snprintf(path, sizeof(path), "%s/0", dir);
+    if ( make_dir(path) ) {
+        fclose(fp);
+        return 1;
+    }
+    index_level(fp, 0, top.w, top.h, tile, filter);
+    tx = (top.w + tile - 1) / tile;
+    nt = tx * ((top.h + tile - 1) / tile);
+
+#pragma omp parallel for default(none) shared(top, dir, tile, tx, nt) reduction(+:failed) schedule(dynamic)
+    for ( t = 0; t < nt; t++ ) {
+        int x0 = (t % tx) * tile, y0 = (t / tx) * tile;
+        int x1 = ( x0 + tile < top.w ) ? x0 + tile : top.w;
+        int y1 = ( y0 + tile < top.h ) ? y0 + tile : top.h;
+
+        failed += write_tile(&top, dir, 0, x0, y0, x1, y1, tile);
+    }
+
+    lv = failed ? -1 : next_levels(fp, dir, &top, 0, tile, filter);
+    fclose(fp);
+    if ( lv < 0 )
+        return 1;
+
+    printf("[Pyramid]->%d levels of %s in %s\n", lv + 1, filters[filter], dir);
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+rows_done(const pyramid* py, int r0, int r1)
+    /* whether rows [r0, r1) of the coloured picture (the top one first) are rendered */
+{
+    const fdata* fd = py->fd;
+    int r;
+
+    for ( r = r0; r < r1; r++ )
+        if ( ! row_is_done(fd, fd->resolution - 1 - r) )
+            return 0;
+
+    return 1;
+}
+
+///////////////////////////////////////
+
+static int
+shrinkable(const pyramid* py, int band)
+    /* whether the rows of level 0 under band of level 1 are all coloured */
+{
+    int margin = ( py->filter == PF_LANCZOS ) ? PYR_TAPS / 2 : 0;
+    int y0 = band * py->tile, y1 = ( y0 + py->tile < py->l1.h ) ? y0 + py->tile : py->l1.h;
+    int r0 = 2 * y0 - margin, r1 = 2 * y1 + margin, b;
+
+    r0 = ( r0 > 0 ) ? r0 : 0;
+    r1 = ( r1 < py->l0.h ) ? r1 : py->l0.h;
+    for ( b = r0 / py->tile; b <= (r1 - 1) / py->tile; b++ )
+        if ( ! py->done0[b] )
+            return 0;
+
+    return 1;
+}
+
+///////////////////////////////////////
+
+static int
+pass(pyramid* py)
+    /*
+     * colours and writes the tiles of level 0 whose rows are done, then
+     * shrinks and writes those of level 1 whose level 0 rows are there,
+     * every time all the ready tiles at once in parallel; returns the tiles
+     */
+{
+    const fdata* fd = py->fd;
+    int* ready = py->ready;
+    int tile = py->tile, tx0 = py->tx0, tx1 = py->tx1;
+    int b, n, t, failed = 0, made = 0;
+
+    /* level 0 */
+    for ( n = 0, b = 0; b < py->nb0; b++ )
+        if ( ! py->done0[b] && rows_done(py, b * tile, ( (b + 1) * tile < py->l0.h ) ? (b + 1) * tile : py->l0.h) )
+            ready[n++] = b;
+#pragma omp parallel for default(none) shared(py, fd, ready, n, tile, tx0) reduction(+:failed) schedule(dynamic) num_threads(fd->num_proc) if(n > 0)
+    for ( t = 0; t < n * tx0; t++ ) {
+        const level* l = &py->l0;
+        int x0 = (t % tx0) * tile, y0 = ready[t / tx0] * tile;
+        int x1 = ( x0 + tile < l->w ) ? x0 + tile : l->w;
+        int y1 = ( y0 + tile < l->h ) ? y0 + tile : l->h;
+        int x, y;
+
+        for ( y = y0; y < y1; y++ )
+            for ( x = x0; x < x1; x++ )
+                memcpy(l->rgb + ((size_t)y * l->w + x) * 3, py->lut[colour_at(fd, x, l->h - 1 - y)], sizeof(rgb_t));
+        failed += write_tile(l, py->dir, 0, x0, y0, x1, y1, tile);
+    }
+    for ( b = 0; b < n; b++ )
+        py->done0[ready[b]] = 1;
+    made += n * tx0;
+
+    /* level 1 */
+    for ( n = 0, b = 0; b < py->nb1; b++ )
+        if ( ! py->done1[b] && shrinkable(py, b) )
+            ready[n++] = b;
+#pragma omp parallel for default(none) shared(py, fd, ready, n, tile, tx1) reduction(+:failed) schedule(dynamic) num_threads(fd->num_proc) if(n > 0)
+    for ( t = 0; t < n * tx1; t++ ) {
+        int x0 = (t % tx1) * tile, y0 = ready[t / tx1] * tile;
+        int x1 = ( x0 + tile < py->l1.w ) ? x0 + tile : py->l1.w;
+        int y1 = ( y0 + tile < py->l1.h ) ? y0 + tile : py->l1.h;
+
+        shrink(&py->l0, &py->l1, x0, y0, x1, y1, py->filter);
+        failed += write_tile(&py->l1, py->dir, 1, x0, y0, x1, y1, tile);
+    }
+    for ( b = 0; b < n; b++ )
+        py->done1[ready[b]] = 1;
+    made += n * tx1;
+
+    if ( failed )
+        __atomic_store_n(&py->failed, 1, __ATOMIC_RELAXED);
+
+    return made;
+}
+
+///////////////////////////////////////
+
+static void*
+builder(void* arg)
+{
+    pyramid* py = (pyramid*)arg;
+    struct timespec ts = { 0, PYR_POLL_NS };
+    long left = py->tiles;
+    int last, made;
+
+    while ( left > 0 && ! __atomic_load_n(&py->failed, __ATOMIC_RELAXED) ) {
+        /* all rows are done once finish is seen, so this pass makes the rest */
+        last = __atomic_load_n(&py->finish, __ATOMIC_ACQUIRE);
+        made = pass(py);
+        py->early += last ? 0 : made;
+        left -= made;
+        if ( left > 0 && ! made )
+            nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////
+pyramid*
+pyramid_start(fdata* fd, const rgb_t* lut, const char* dir, int tile, int filter)
+    /*
+     * levels 0 and 1 are built while the picture is being rendered, as
+     * the rows of their tiles get done; the colours have to be fixed
+     */
+{
+    pyramid* py = (pyramid*)calloc(1, sizeof(pyramid));
+    char path[PYR_PATH];
+    int n = fd->resolution;
+
+#ifdef DEBUG
+    printf("[Pyramid]->pyramid_start: %s, tiles of %d, %s filter\n", dir, tile, filters[filter]);
+#endif
+
+    if ( py == NULL )
+        return NULL;
+    py->fd = fd;
+    py->dir = dir;
+    py->tile = tile;
+    py->filter = filter;
+    if ( filter == PF_LANCZOS )
+        lanczos_init();
+
+    /* a picture fitting in one tile is level 0 alone */
+    py->l0.w = py->l0.h = n;
+    py->l1.w = py->l1.h = ( n > tile ) ? (n + 1) / 2 : 0;
+    py->tx0 = (py->l0.w + tile - 1) / tile;
+    py->nb0 = (py->l0.h + tile - 1) / tile;
+    py->tx1 = (py->l1.w + tile - 1) / tile;
+    py->nb1 = (py->l1.h + tile - 1) / tile;
+    py->tiles = (long)py->tx0 * py->nb0 + (long)py->tx1 * py->nb1;
+
+    py->lut = (rgb_t*)malloc(colour_size(fd) * sizeof(rgb_t));
+    py->l0.rgb = (unsigned char*)malloc((size_t)n * n * 3);
+    py->l1.rgb = (unsigned char*)malloc((size_t)py->l1.w * py->l1.h * 3 + 1);
+    py->done0 = (char*)calloc(py->nb0, sizeof(char));
+    py->done1 = (char*)calloc(py->nb1 + 1, sizeof(char));
+    py->ready = (int*)malloc((py->nb0 + 1) * sizeof(int));
+    if ( fd->rowdone == NULL )
+        fd->rowdone = py->rowdone = (char*)calloc(n, sizeof(char));
+    if ( py->lut == NULL || py->l0.rgb == NULL || py->l1.rgb == NULL || py->done0 == NULL || py->done1 == NULL
+            || py->ready == NULL || fd->rowdone == NULL ) {
+        printf("Error: Not enough memory for the pyramid\n");
+        py->failed = 1;
+        pyramid_finish(py, 0);
+        return NULL;
+    }
+    memcpy(py->lut, lut, colour_size(fd) * sizeof(rgb_t));
+
+    if ( (py->index = open_index(dir)) == NULL ) {
+        py->failed = 1;
+        pyramid_finish(py, 0);
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/0", dir);
+    py->failed = make_dir(path);
+    snprintf(path, sizeof(path), "%s/1", dir);
+    if ( py->failed || (py->nb1 > 0 && make_dir(path)) ) {
+        py->failed = 1;
+        pyramid_finish(py, 0);
+        return NULL;
+    }
+
+    if ( pthread_create(&py->thread, NULL, builder, py) ) {
+        perror("[Pyramid]->pthread_create");
+        py->failed = 1;
+        pyramid_finish(py, 0);
+        return NULL;
+    }
+    py->started = 1;
+
+    return py;
+}
+
+///////////////////////////////////////
+int
+pyramid_finish(pyramid* py, int complete)
+    /*
+     * with complete all rows have to be done by now: the rest of levels 0
+     * and 1 is built and the smaller levels follow from level 1;
+     * otherwise the render failed and nothing more is written
+     */
+{
+    int lv = -1, failed;
+
+#ifdef DEBUG
+    printf("[Pyramid]->pyramid_finish\n");
+#endif
+
+    if ( ! complete )
+        __atomic_store_n(&py->failed, 1, __ATOMIC_RELAXED);
+    if ( py->started ) {
+        __atomic_store_n(&py->finish, 1, __ATOMIC_RELEASE);
+        pthread_join(py->thread, NULL);
+        printf("[Pyramid]->%ld of %ld tiles of levels 0 and 1 written during the render\n", py->early, py->tiles);
+    }
+
+    if ( ! py->failed ) {
+        omp_set_num_threads(py->fd->num_proc);
+        index_level(py->index, 0, py->l0.w, py->l0.h, py->tile, py->filter);
+        if ( py->nb1 > 0 ) {
+            index_level(py->index, 1, py->l1.w, py->l1.h, py->tile, py->filter);
+            lv = next_levels(py->index, py->dir, &py->l1, 1, py->tile, py->filter);
+        } else
+            lv = 0;
+        if ( lv < 0 )
+            py->failed = 1;
+        else
+            printf("[Pyramid]->%d levels of %s in %s\n", lv + 1, filters[py->filter], py->dir);
+    }
+    if ( py->index != NULL )
+        fclose(py->index);
+
+    if ( py->rowdone != NULL ) {
+        py->fd->rowdone = NULL;
+        free(py->rowdone);
+    }
+    free(py->lut);
+    free(py->l0.rgb);
+    free(py->l1.rgb);
+    free(py->done0);
+    free(py->done1);
+    free(py->ready);
+    failed = py->failed;
+    free(py);
+
+    return failed;
+}
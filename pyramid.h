@@ -0,0 +1,24 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef PYRAMIDH
+#define PYRAMIDH
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+/* filters of the 2x downsampling */
+enum { PF_BOX = 0, PF_LANCZOS };
+
+typedef struct pyramid pyramid;
+
+extern int pyramid_filter(const char* name);
+extern int pyramid_write(const fdata*, const unsigned char* rgb, const char* dir, int tile, int filter);
+extern pyramid* pyramid_start(fdata*, const rgb_t* lut, const char* dir, int tile, int filter);
+extern int pyramid_finish(pyramid*, int complete);
+
+#endif
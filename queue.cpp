@@ -0,0 +1,364 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Kolejka zadan
+ * Render queue
+ *
+ * Many small pictures share one pool of threads instead of each of them
+ * being split over all threads on its own. A job is a line of the job
+ * file (or of the standard input, "-"):
+ *
+ *	xmin xmax ymin ymax resolution maxiter [priority [file]]
+ *
+ * the rest (formula, threshold, palette) comes from the command line.
+ * Jobs are cut into bands of QUEUE_ROWS rows and the pool takes bands of
+ * all jobs at once. The band goes to the job which has received the least
+ * work for its priority so far (stride scheduling), so a job of priority 2
+ * gets twice the threads of a job of priority 1. The thread finishing the
+ * last band of a job colours and writes it, so jobs complete out of order.
+ * Jobs are read while the others render and wait for memory when the ones
+ * in progress would take more than the budget.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <omp.h>
+
+#include "mandelbrot_set.h"
+#include "queue.h"
+#include "colour.h"
+#include "formula.h"
+#include "affinity.h"
+
+#define QUEUE_ROWS	16	/* rows handed out at once */
+#define QUEUE_NAME	256	/* longest output file name */
+
+typedef struct qjob {
+    fdata fd;		/* the picture, with a table of its own */
+    int id, prio;
+    char file[QUEUE_NAME];
+    int next;		/* first row nobody has taken yet */
+    int left;		/* bands not finished */
+    double pass;		/* work received divided by priority */
+    size_t mem;		/* bytes taken from the budget */
+    double start;		/* when the job was read */
+    struct qjob* link;	/* next job with bands to hand out */
+} qjob;
+
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qwork = PTHREAD_COND_INITIALIZER;	/* a new job or the end of the file */
+static pthread_cond_t qroom = PTHREAD_COND_INITIALIZER;	/* a job has given its memory back */
+
+static qjob* active;	/* jobs with bands to hand out */
+static int reading;	/* the job file is still being read */
+static size_t used, budget;	/* memory of the jobs in progress */
+static double vtime;	/* pass of the last band handed out, new jobs start there */
+static int done, failed;
+
+static double* qbusy;	/* seconds every thread spent on bands and on finishing jobs */
+static const palette* qpal;
+static int qequalize;
+
+///////////////////////////////////////
+
+static qjob*
+pick(int* y)
+    /* the job which is to get the next band (under qlock); *y is the band's first row */
+{
+    qjob *j, *best = NULL, **prev, **bprev = NULL;
+    int rows;
+
+    for ( prev = &active, j = active; j != NULL; prev = &j->link, j = j->link )
+        if ( best == NULL || j->pass < best->pass ) {
+            best = j;
+            bprev = prev;
+        }
+    if ( best == NULL )
+        return NULL;
+
+    *y = best->next;
+    rows = ( best->fd.resolution - *y < QUEUE_ROWS ) ? best->fd.resolution - *y : QUEUE_ROWS;
+    best->next += rows;
+    vtime = best->pass;
+    best->pass += (double)rows * best->fd.resolution / best->prio;
+
+    /* everything handed out, the job stays alive until its last band is done */
+    if ( best->next >= best->fd.resolution )
+        *bprev = best->link;
+
+    return best;
+}
+
+///////////////////////////////////////
+
+static void
+finish_job(qjob* j)
+    /* colours and writes the picture, then frees it */
+{
+    rgb_t* lut;
+    unsigned char* rgb;
+    int n = j->fd.resolution;
+
+    rgb = (unsigned char*)malloc((size_t)n * n * 3);
+    lut = (rgb_t*)malloc(colour_size(&j->fd) * sizeof(rgb_t));
+    if ( rgb == NULL || lut == NULL || colour_lut(&j->fd, qpal, qequalize, lut) ) {
+        printf("Error: [Queue]->Job %d: not enough memory for the coloured picture\n", j->id);
+        __sync_fetch_and_add(&failed, 1);
+    } else {
+        colour_apply(&j->fd, lut, rgb);
+        if ( write_ppm(&j->fd, rgb, j->file) )
+            __sync_fetch_and_add(&failed, 1);
+        else
+            printf("[Queue]->Job %d (%s): %dx%d, priority %d, done in %.3f s\n",
+                    j->id, j->file, n, n, j->prio, omp_get_wtime() - j->start);
+    }
+
+    free(rgb);
+    free(lut);
+    free(j->fd.tab[0]);
+    free(j->fd.tab);
+    if ( j->fd.counts != NULL ) {
+        free(j->fd.counts[0]);
+        free(j->fd.counts);
+    }
+    free(j);
+}
+
+///////////////////////////////////////
+
+static void*
+pool_worker(void* arg)
+{
+    int id = (int)(long)arg;
+    qjob* j;
+    double t;
+    int y, yl;
+
+    affinity_pin(id);
+
+    pthread_mutex_lock(&qlock);
+    while ( (j = pick(&yl)) != NULL || reading ) {
+        if ( j == NULL ) {
+            pthread_cond_wait(&qwork, &qlock);
+            continue;
+        }
+        pthread_mutex_unlock(&qlock);
+
+        t = - omp_get_wtime();
+        for ( y = yl; y < yl + QUEUE_ROWS && y < j->fd.resolution; y++ )
+            render_row(&j->fd, y);
+
+        pthread_mutex_lock(&qlock);
+        if ( --j->left == 0 ) {
+            size_t mem = j->mem;
+
+            pthread_mutex_unlock(&qlock);
+            finish_job(j);
+            pthread_mutex_lock(&qlock);
+            used -= mem;
+            done++;
+            pthread_cond_broadcast(&qroom);
+        }
+        t += omp_get_wtime();
+        qbusy[id] += t;
+    }
+    pthread_mutex_unlock(&qlock);
+
+    return NULL;
+}
+
+///////////////////////////////////////
+
+static qjob*
+parse_job(const fdata* fd, const char* line, int id)
+    /* the job described by a line of the job file, NULL if it is wrong */
+{
+    qjob* j = (qjob*)calloc(1, sizeof(qjob));
+    double xmin, xmax, ymin, ymax;
+    int n, maxiter, prio = 1, k;
+
+    if ( j == NULL )
+        return NULL;
+    k = sscanf(line, "%lf %lf %lf %lf %d %d %d %255s", &xmin, &xmax, &ymin, &ymax, &n, &maxiter, &prio, j->file);
+    if ( k < 6 || xmax <= xmin || ymax <= ymin || n < 1 || maxiter < 1 || prio < 1 ) {
+        printf("Error: [Queue]->Wrong job %d: %s", id, line);
+        free(j);
+        return NULL;
+    }
+    if ( k < 8 )
+        snprintf(j->file, QUEUE_NAME, "job-%d.ppm", id);
+
+    /* formula, threshold and the like are the ones of the command line */
+    j->fd = *fd;
+    j->fd.xmin = xmin;
+    j->fd.xmax = xmax;
+    j->fd.ymin = ymin;
+    j->fd.ymax = ymax;
+    j->fd.resolution = n;
+    j->fd.maxiter = maxiter;
+    j->fd.xdiff = (xmax - xmin) / n;
+    j->fd.ydiff = (ymax - ymin) / n;
+    j->fd.xo = j->fd.yo = 0;
+    j->fd.tab = NULL;
+    j->fd.counts = NULL;
+    j->fd.rowdone = NULL;
+    j->fd.cancel = NULL;
+    j->fd.touch = 0;
+    /* the pool is parallel enough, colouring a job takes one thread */
+    j->fd.num_proc = 1;
+
+    j->id = id;
+    j->prio = prio;
+    j->left = (n + QUEUE_ROWS - 1) / QUEUE_ROWS;
+    /* the table and the coloured picture, and the full counts when the colours need them */
+    j->mem = sizeof(qjob) + (size_t)n * sizeof(char*) + (size_t)n * n * 4;
+    if ( colour_wide(&j->fd, qpal, qequalize) )
+        j->mem += (size_t)n * sizeof(int*) + (size_t)n * n * sizeof(int);
+
+    return j;
+}
+
+///////////////////////////////////////
+
+static int
+alloc_job(qjob* j)
+{
+    int i, n = j->fd.resolution;
+
+    j->fd.tab = (char**)malloc(n * sizeof(char*));
+    if ( j->fd.tab == NULL )
+        return 1;
+    j->fd.tab[0] = (char*)malloc((size_t)n * n);
+    if ( j->fd.tab[0] == NULL ) {
+        free(j->fd.tab);
+        return 1;
+    }
+    for ( i = 1; i < n; i++ )
+        j->fd.tab[i] = j->fd.tab[0] + (size_t)i * n;
+
+    if ( ! colour_wide(&j->fd, qpal, qequalize) )
+        return 0;
+    j->fd.counts = (int**)malloc(n * sizeof(int*));
+    if ( j->fd.counts == NULL || (j->fd.counts[0] = (int*)malloc((size_t)n * n * sizeof(int))) == NULL ) {
+        free(j->fd.counts);
+        j->fd.counts = NULL;
+        free(j->fd.tab[0]);
+        free(j->fd.tab);
+        return 1;
+    }
+    for ( i = 1; i < n; i++ )
+        j->fd.counts[i] = j->fd.counts[0] + (size_t)i * n;
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+queue_run(const fdata* fd, const char* file, long memory_mb, const palette* p, int equalize)
+{
+    pthread_t* pool;
+    char line[1024];
+    long long pixels = 0;
+    double t, sum = 0;
+    FILE* in;
+    qjob* j;
+    int i, id = 0;
+
+#ifdef DEBUG
+    printf("[Queue]->queue_run: %s, %d threads, %ld MB\n", file, fd->num_proc, memory_mb);
+#endif
+
+    in = strcmp(file, "-") ? fopen(file, "r") : stdin;
+    if ( in == NULL ) {
+        perror("[Queue]->queue_run");
+        return 1;
+    }
+
+    qpal = p;
+    qequalize = equalize;
+    active = NULL;
+    reading = 1;
+    used = 0;
+    budget = (size_t)memory_mb << 20;
+    vtime = 0;
+    done = failed = 0;
+
+    pool = (pthread_t*)malloc(fd->num_proc * sizeof(pthread_t));
+    qbusy = (double*)calloc(fd->num_proc, sizeof(double));
+
+    t = - omp_get_wtime();
+    for ( i = 0; i < fd->num_proc; i++ )
+        pthread_create(&pool[i], NULL, pool_worker, (void*)(long)i);
+
+    /* this thread reads the jobs while the pool renders */
+    while ( fgets(line, sizeof(line), in) != NULL ) {
+        char* s = line + strspn(line, " \t");
+
+        if ( *s == '#' || *s == '\n' || *s == '\0' )
+            continue;
+        if ( (j = parse_job(fd, s, ++id)) == NULL ) {
+            __sync_fetch_and_add(&failed, 1);
+            continue;
+        }
+        if ( j->mem > budget ) {
+            printf("Error: [Queue]->Job %d needs %zu MB, more than the budget\n", id, (j->mem >> 20) + 1);
+            free(j);
+            __sync_fetch_and_add(&failed, 1);
+            continue;
+        }
+
+        pthread_mutex_lock(&qlock);
+        while ( used + j->mem > budget )
+            pthread_cond_wait(&qroom, &qlock);
+        used += j->mem;
+        pthread_mutex_unlock(&qlock);
+
+        if ( alloc_job(j) ) {
+            printf("Error: [Queue]->Not enough memory for job %d\n", id);
+            pthread_mutex_lock(&qlock);
+            used -= j->mem;
+            pthread_mutex_unlock(&qlock);
+            free(j);
+            __sync_fetch_and_add(&failed, 1);
+            continue;
+        }
+        pixels += (long long)j->fd.resolution * j->fd.resolution;
+        j->start = omp_get_wtime();
+
+        /* a new job does not get ahead of those waiting for a long time */
+        pthread_mutex_lock(&qlock);
+        j->pass = vtime;
+        j->link = active;
+        active = j;
+        pthread_cond_broadcast(&qwork);
+        pthread_mutex_unlock(&qlock);
+    }
+    if ( in != stdin )
+        fclose(in);
+
+    pthread_mutex_lock(&qlock);
+    reading = 0;
+    pthread_cond_broadcast(&qwork);
+    pthread_mutex_unlock(&qlock);
+
+    for ( i = 0; i < fd->num_proc; i++ ) {
+        pthread_join(pool[i], NULL);
+        sum += qbusy[i];
+    }
+    t += omp_get_wtime();
+
+    printf("[Queue]->%d jobs done, %d failed, %lld pixels in %.3f s (%.3g pixels/s), threads busy %.1f%%\n",
+            done, failed, pixels, t, pixels / t, 100.0 * sum / (t * fd->num_proc));
+
+    free(pool);
+    free(qbusy);
+
+    return failed != 0;
+}
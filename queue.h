@@ -0,0 +1,16 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef QUEUEH
+#define QUEUEH
+
+#include "mandelbrot_set.h"
+#include "colour.h"
+
+extern int queue_run(const fdata*, const char* file, long memory_mb, const palette*, int equalize);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+/*
+ * Frame buffer placed in a named POSIX shared memory segment
+ *
+ * The renderer writes pixels straight into the segment and marks rows
+ * as finished; a viewer maps the same segment read-only and may show
+ * the rows as soon as they are done, without any file in between.
+ *
+ * Every renderer puts its pid into the header while it is attached, so a
+ * viewer waiting for rows notices when nobody is left to render them.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mandelbrot_set.h"
+#include "shm_output.h"
+
+#define SHM_WAIT_US	10000	/* between looks at a segment being created */
+#define SHM_TRIES	500	/* looks before giving up on it */
+
+static void* segment = NULL;	/* mapped segment, there is one per process */
+static size_t seglen = 0;
+static int slot = -1;		/* our place in writers[] */
+
+///////////////////////////////////////
+
+static size_t
+shm_size(int resolution, uint64_t* data)
+{
+    /* pixels start on a page boundary */
+    *data = (sizeof(shm_header) + resolution + 4095) & ~(uint64_t)4095;
+    return *data + (size_t)resolution * resolution;
+}
+
+///////////////////////////////////////
+
+static void
+shm_rows(fdata* fd, char* base, const shm_header* h)
+    /* rows of tab point into the segment */
+{
+    int i;
+
+    fd->tab = (char**)malloc(fd->resolution * sizeof(char*));
+    for(i=0; i < fd->resolution; i++)
+        fd->tab[i] = base + h->data + (size_t)i * fd->resolution;
+    fd->rowdone = base + sizeof(shm_header);
+}
+
+///////////////////////////////////////
+
+static off_t
+shm_wait_size(int sfd)
+    /* size of the segment once its creator has set it, 0 if it never does */
+{
+    struct stat st;
+    int t;
+
+    for ( t = 0; t < SHM_TRIES; t++ ) {
+        if ( fstat(sfd, &st) )
+            return 0;
+        if ( st.st_size > 0 )
+            return st.st_size;
+        usleep(SHM_WAIT_US);
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static int
+shm_wait_magic(shm_header* h)
+    /* 0 once the creator has published the header */
+{
+    int t;
+
+    for ( t = 0; t < SHM_TRIES; t++ ) {
+        if ( __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC )
+            return 0;
+        usleep(SHM_WAIT_US);
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////
+
+static int
+shm_alive(const shm_header* h)
+    /* whether any renderer is still attached */
+{
+    int i, pid;
+
+    for ( i = 0; i < SHM_WRITERS; i++ ) {
+        pid = __atomic_load_n(&h->writers[i], __ATOMIC_ACQUIRE);
+        if ( pid > 0 && ( ! kill(pid, 0) || errno == EPERM ) )
+            return 1;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////
+
+static void
+shm_register(shm_header* h)
+    /* takes a free slot of writers[], or the one of a renderer which died */
+{
+    int i, pid, me = getpid();
+
+    for ( i = 0; i < SHM_WRITERS; i++ ) {
+        pid = __atomic_load_n(&h->writers[i], __ATOMIC_ACQUIRE);
+        if ( pid > 0 && ( ! kill(pid, 0) || errno == EPERM ) )
+            continue;
+        if ( __atomic_compare_exchange_n(&h->writers[i], &pid, me, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+            slot = i;
+            return;
+        }
+    }
+    printf("[Main]->More than %d renderers on the segment, a viewer does not watch this one\n", SHM_WRITERS);
+}
+
+///////////////////////////////////////
+int
+shm_attach(fdata* fd, const char* name)
+    /*
+     * creates the segment, or attaches to an existing one of the same size
+     * so that several processes can fill disjoint parts of it
+     */
+{
+    int sfd, created = 1;
+    uint64_t data;
+    size_t len = shm_size(fd->resolution, &data);
+    shm_header* h;
+
+#ifdef DEBUG
+    printf("[Main]->shm_attach: %s\n", name);
+#endif
+
+    sfd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if ( sfd < 0 ) {
+        created = 0;
+        sfd = shm_open(name, O_RDWR, 0644);
+    }
+    if ( sfd < 0 ) {
+        perror("[Main]->shm_open");
+        return 1;
+    }
+    if ( created && ftruncate(sfd, len) ) {
+        perror("[Main]->ftruncate");
+        close(sfd);
+        shm_unlink(name);
+        return 1;
+    }
+    /* the creator may not have sized it yet; pages past the size would raise SIGBUS */
+    if ( ! created && shm_wait_size(sfd) != (off_t)len ) {
+        printf("Error: Shared memory segment %s holds a different picture\n", name);
+        close(sfd);
+        return 1;
+    }
+
+    segment = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, sfd, 0);
+    close(sfd);
+    if ( segment == MAP_FAILED ) {
+        perror("[Main]->mmap");
+        segment = NULL;
+        return 1;
+    }
+    seglen = len;
+    h = (shm_header*)segment;
+
+    if ( created ) {
+        h->version = SHM_VERSION;
+        h->width = h->height = fd->resolution;
+        h->pixel = SHM_PIXEL_CHAR;
+        h->data = data;
+        h->writers[0] = getpid();
+        slot = 0;
+        /* magic is written last, a reader seeing it sees the whole header */
+        __atomic_store_n(&h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    } else if ( shm_wait_magic(h) || h->version != SHM_VERSION
+            || h->width != fd->resolution || h->height != fd->resolution ) {
+        printf("Error: Shared memory segment %s holds a different picture\n", name);
+        shm_detach(fd);
+        return 1;
+    } else
+        shm_register(h);
+
+    shm_rows(fd, (char*)segment, h);
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+shm_view(fdata* fd, const char* name)
+    /*
+     * maps the segment read-only and waits for all the rows;
+     * fd gets the picture's resolution and tab, the segment is removed
+     */
+{
+    int sfd, done, last = -1, y, alive = 1;
+    off_t size;
+    shm_header* h;
+
+    sfd = shm_open(name, O_RDONLY, 0);
+    if ( sfd < 0 ) {
+        perror("[Viewer]->shm_open");
+        return 1;
+    }
+    if ( (size = shm_wait_size(sfd)) < (off_t)sizeof(shm_header) ) {
+        printf("Error: Shared memory segment %s is not ready\n", name);
+        close(sfd);
+        return 1;
+    }
+    segment = mmap(NULL, size, PROT_READ, MAP_SHARED, sfd, 0);
+    close(sfd);
+    if ( segment == MAP_FAILED ) {
+        perror("[Viewer]->mmap");
+        segment = NULL;
+        return 1;
+    }
+    seglen = size;
+    h = (shm_header*)segment;
+
+    if ( shm_wait_magic(h) || h->version != SHM_VERSION || h->pixel != SHM_PIXEL_CHAR
+            || h->data + (uint64_t)h->width * h->height > seglen ) {
+        printf("Error: Shared memory segment %s is not a picture\n", name);
+        shm_detach(fd);
+        return 1;
+    }
+
+    fd->resolution = h->width;
+    shm_rows(fd, (char*)segment, h);
+
+    /*
+     * rows are reported as they come; the renderers are looked at before
+     * the rows, so the rows of one which has just finished are not missed
+     */
+    do {
+        alive = shm_alive(h);
+        for ( done = 0, y = 0; y < fd->resolution; y++ )
+            done += __atomic_load_n(&fd->rowdone[y], __ATOMIC_ACQUIRE);
+        if ( done != last ) {
+            printf("[Viewer]->Rows done: %d/%d\n", done, fd->resolution);
+            fflush(stdout);
+            last = done;
+        }
+        if ( done < fd->resolution && alive )
+            usleep(100000);
+    } while ( done < fd->resolution && alive );
+
+    if ( done < fd->resolution ) {
+        /* the segment stays, a renderer attaching to it again finishes the picture */
+        printf("Error: No renderer is attached to %s, %d of %d rows are done\n", name, done, fd->resolution);
+        shm_detach(fd);
+        return 1;
+    }
+
+    /* the whole frame is ours, the name is not needed any more (the mapping stays valid) */
+    shm_unlink(name);
+
+    return 0;
+}
+
+///////////////////////////////////////
+int
+shm_detach(fdata* fd)
+{
+    int me = getpid();
+
+    /* the viewer maps read-only and has no slot */
+    if ( segment != NULL && slot >= 0 )
+        __atomic_compare_exchange_n(&((shm_header*)segment)->writers[slot], &me, 0, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    slot = -1;
+
+    free(fd->tab);
+    fd->tab = NULL;
+    fd->rowdone = NULL;
+
+    if ( segment != NULL )
+        munmap(segment, seglen);
+    segment = NULL;
+    seglen = 0;
+
+    return 0;
+}
+
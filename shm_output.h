@@ -0,0 +1,38 @@
+/*
+ * EDS - Parallel Mandelbrot set generation
+ *
+ * Author: Krzysztof Voss [shobbo@gmail.com]
+ *
+ */
+
+#ifndef SHMOUTPUTH
+#define SHMOUTPUTH
+
+#include <stdint.h>
+
+#include "mandelbrot_set.h"
+
+#define SHM_MAGIC	0x4d485345	/* "ESHM" */
+#define SHM_VERSION	2
+#define SHM_PIXEL_CHAR	1	/* one char (iteration count) per pixel */
+#define SHM_WRITERS	16	/* renderers attached at once that a viewer can watch */
+
+/*
+ * Layout of the segment: header, one completion flag per row,
+ * then the pixels row by row starting at offset data
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height;
+    int32_t pixel;		/* SHM_PIXEL_* */
+    int32_t pad;
+    uint64_t data;		/* offset of the first pixel */
+    int32_t writers[SHM_WRITERS];	/* pids of the attached renderers, 0 - free slot */
+} shm_header;
+
+extern int shm_attach(fdata*, const char* name);
+extern int shm_view(fdata*, const char* name);
+extern int shm_detach(fdata*);
+
+#endif
@@ -6,6 +6,7 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <pthread.h>
 #include <complex>
 #include <cmath>
@@ -13,56 +14,34 @@
 
 #include "mandelbrot_set.h"
 #include "worker.h"
+#include "formula.h"
+#include "distance.h"
+#include "affinity.h"
+#include "perfctr.h"
 
 using namespace std;
 
-/*
- *	Z0 = 0
- *	Zn = Z(n-1) + C
- *
- *	abs(c) <T
- */
-static int 
-fractal_point(const complex<double> c, fdata *fd)
-    /* oblicza jak szybko ucieka punkt o wspolrzednych zespolonych */
-    /* counts how fast the point described with complex coordinates is moving from its origins */
-{
-    complex<double> Zn;
-    int n;
-
-    if ( abs(c) >= fd->T ) //point is already over the range
-        return 0;
-
-    for ( n=1, Zn=c;  // we start with 1 because point is not over the range on the very beginning
-            abs(Zn)< fd->T && n < fd->maxiter+1;
-            n++)
-    {
-        Zn = Zn * Zn + c;
-    }
-
-    return n-1; //due to the last incrementation in the FOR loop
-}
-
 ///////////////////////////////////////
 static void
-get_job(fdata* fd)
+get_job(wdata* fd)
 {
+    mgroup* g = fd->grp;
 
 #ifdef DEBUG
     printf("[Worker-%d]->Locking manager\n", fd->wID);
 #endif
-    if (! pthread_mutex_lock(&mutex)) {
+    if (! pthread_mutex_lock(&g->mutex)) {
 #ifdef DEBUG
         // we have locked the manager
         printf("\t[Worker-%d]->Manager locked!!!\n", fd->wID);
 #endif
         // setting the number of the free thread
         while(1) {
-            if ( freeProc < 0 ) {
+            if ( g->freeProc < 0 ) {
 #ifdef DEBUG
                 printf("\t[Worker-%d]->Manager is ready to serve us!!!\n", fd->wID);
 #endif
-                freeProc = fd->wID;
+                g->freeProc = fd->wID;
                 break;
             } else {
                 // a jezeli ktos juz ustawil swoj numer to czekamy az menadzer go zwolni
@@ -70,90 +49,74 @@ get_job(fdata* fd)
 #ifdef DEBUG
                 printf("\t[Worker-%d]->Sleeping until peer has been served\n", fd->wID);
 #endif
-                pthread_cond_wait(&mfree, &mutex);
+                pthread_cond_wait(&g->mfree, &g->mutex);
                 continue;
             }
         }
 
         /* zdejmuje mutex z szefa przy spelnionym warunku */
         /* unlocks the manage's mutex when condition is satisfied*/
-        pthread_mutex_unlock(&mutex);
+        pthread_mutex_unlock(&g->mutex);
 
-        pthread_mutex_lock(&muti);
+        pthread_mutex_lock(&g->muti);
 
         /* budzimy szefa */
         /* waking manager up */
-        pthread_cond_signal(&cond);
+        pthread_cond_signal(&g->cond);
 #ifdef DEBUG
         printf("\t\t[Worker-%d]->Waking manager up\n", fd->wID);
 #endif
 
-        pthread_cond_wait(&mdone, &muti);
+        pthread_cond_wait(&g->mdone, &g->muti);
 #ifdef DEBUG
         //printf("\t\t\t[Worker-%d]->Woke up after pthread_cond_wait\n", fd->wID);
 #endif
-        pthread_mutex_unlock(&muti);
+        pthread_mutex_unlock(&g->muti);
     }
 }
 
 ///////////////////////////////////////
 
 static int
-gen_fractal(fdata* d)
+claim_row(wdata* d)
+    /* takes the first of our rows, -1 if there are none left; the manager may take the rest away meanwhile */
 {
-    int yl;
-    int xl;
-    complex<double> c;
+    uint64_t r = __atomic_load_n(&d->rows, __ATOMIC_ACQUIRE);
+    int yl, yh;
 
-    double ydiff = d->ydiff;
-    double xdiff = d->xdiff;
+    do {
+        yl = ROWS_LO(r);
+        yh = ROWS_HI(r);
+        if ( yl >= yh )
+            return -1;
+    } while ( ! __atomic_compare_exchange_n(&d->rows, &r, ROWS(yl + 1, yh), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) );
 
-    char** tab = d->tab;
+    return yl;
+}
 
-    double xmin = d->xmin;
-    double xmax = d->xmax; 
-    double ymin = d->ymin;
-    double ymax = d->ymax; 
+///////////////////////////////////////
+
+static int
+gen_fractal(wdata* d)
+{
+    int yl;
 
 #ifdef DEBUG
-    printf("[Worker-%d]->gen_fractal: %d %d\n", d->wID, d->yl, d->yh);
+    printf("[Worker-%d]->gen_fractal: %d %d\n", d->wID, ROWS_LO(d->rows), ROWS_HI(d->rows));
 #endif
 
-    pthread_mutex_lock(d->mutt);
-    while(1) {
-        /* sprawdzamy czy mamy co liczyc */
-        /* do we have anything to count? */
-        yl = d->yl;
-        if ( yl < d->yh ) {
-            pthread_mutex_unlock(d->mutt);
-        } else {
-            // nie mamy co robic
-            // we don't have anything to do
-            d->status = 0;
-            break;
-        }
-
-        for(xl=d->xl; xl < d->xh; xl++) {
-            /* dodajemy jeszcze pol roznicy bo chcemy liczyc od srodka pierwszego pola */
-            /* adding half of the field size because we want to count beggining with the middle of the first field */
-            c = complex<double>(xmin+(xl+0.5)*xdiff, ymin+(yl+0.5)*ydiff); 
-            tab[yl][xl] = fractal_point(c, d);
-        }
-
+    /*
+     * wiersze bierzemy bez blokowania; szef zabiera nam koncowke tez atomowo
+     * rows are taken without locking; the manager takes the tail of them atomically too
+     */
+    while ( (yl = claim_row(d)) >= 0 )
+        render_row(d->fd, yl);
 
-        // po zrobieniu linii zamykamy klodke, jezeli jest zamknieta to znaczy, ze szef zatrzymuje tutaj watek.
-        // after completing the line we lock the mutex, if its already locked it means manager has stopped the thread over here
-        // blad: MOZLIWE PRZEOCZENIE LINII - ale nie zmieniamy d->yl wiec spokojnie
-        pthread_mutex_lock(d->mutt);
-
-        ++yl;
-        d->yl = yl;
-        if ( !(yl < d->yh) ) {
-            d->status = 0;
-            break;
-        }
-    }
-    pthread_mutex_unlock(d->mutt);
+    // nie mamy co robic
+    // we don't have anything to do
+    pthread_mutex_lock(&d->mutt);
+    d->status = 0;
+    pthread_mutex_unlock(&d->mutt);
 
     return 0;
 }
@@ -190,38 +153,43 @@ map(int type, cords* c)
 }
 //////////////////////////////////////
 static int 
-addr(fdata* fd, int sq, cords* c)
+addr(const fdata* fd, int sq, cords* c)
 {
     int osq; //other square
 
     if ( sq == 0 ) {
-        c->xmin = fd->xmin;
-        c->xmax = fd->xmax;
-        c->ymin = fd->ymin;
-        c->ymax = fd->ymax;
+        /* the whole picture, which may be only a part (xo, yo) of a bigger one */
+        c->xmin = fd->xmin + fd->xo * fd->xdiff;
+        c->xmax = fd->xmin + (fd->xo + fd->resolution) * fd->xdiff;
+        c->ymin = fd->ymin + fd->yo * fd->ydiff;
+        c->ymax = fd->ymin + (fd->yo + fd->resolution) * fd->ydiff;
         return 0;
     }
     osq = (int)floor(( sq - 1 ) / 4);
     /* RECURRENCE */
     addr(fd, osq, c);
     map( sq%4, c);
+
+    return 0;
 }
 //////////////////////////////////////
 static int
-addrPix(fdata* fd, cords* c)
+addrPix(wdata* d, cords* c)
     /* we are checking what pixels that would be and we are saving them in our raport */
 {
-    fd->xl = floor((c->xmin - fd->xmin) / fd->xdiff);
-    fd->xh = floor((c->xmax - fd->xmin) / fd->xdiff);
-    fd->yl = floor((c->ymin - fd->ymin) / fd->ydiff);
-    fd->yh = floor((c->ymax - fd->ymin) / fd->ydiff);
+    const fdata* fd = d->fd;
+
+    d->xl = floor((c->xmin - fd->xmin) / fd->xdiff) - fd->xo;
+    d->xh = floor((c->xmax - fd->xmin) / fd->xdiff) - fd->xo;
+    d->yl = floor((c->ymin - fd->ymin) / fd->ydiff) - fd->yo;
+    d->yh = floor((c->ymax - fd->ymin) / fd->ydiff) - fd->yo;
 
     return 0;
 }
 //////////////////////////////////////
 //////////////////////////////////////
 static int
-sizeBox(fdata* fd)
+sizeBox(const wdata* fd)
 {
     int x, y;
     x = fd->xh - fd->xl;
@@ -230,55 +198,39 @@ sizeBox(fdata* fd)
 }
 //////////////////////////////////////
 static void
-countBox(fdata *fd)
+countBox(wdata* d)
 {
-    int xl, yl;
-
-    complex<double> c;
-
-    double ydiff = fd->ydiff;
-    double xdiff = fd->xdiff;
-
-    char** tab = fd->tab;
-
-    double xmin = fd->xmin;
-    double xmax = fd->xmax; 
-    double ymin = fd->ymin;
-    double ymax = fd->ymax; 
+    int yl;
 
 #ifdef DEBUG
-    //	printf("\t\t[Worker-%d]->countBox\n", fd->wID);
+    //	printf("\t\t[Worker-%d]->countBox\n", d->wID);
 #endif
-    for ( yl = fd->yl; yl < fd->yh; yl++ )
-        for ( xl = fd->xl; xl < fd->xh; xl++ ) {
-            c = complex<double>(xmin+(xl+0.5)*xdiff, ymin+(yl+0.5)*ydiff); 
-            tab[yl][xl] = fractal_point(c, fd);
-        }
+    for ( yl = d->yl; yl < d->yh; yl++ )
+        render_span(d->fd, yl, d->xl, d->xh);
 
     return;
 }
 //////////////////////////////////////
 static void
-fulfillBox(fdata* fd, int v)
+fulfillBox(wdata* fd, int v)
     /* fulfills whole box b with value v */
 {
     int xl, yl;
-    char** tab = fd->tab;
 #ifdef DEBUG
     //	printf("\t\t[Worker-%d]->fulfillBox v=%d, xl=%d, xh=%d, yl=%d, yh=%d\n", fd->wID, v, fd->xl, fd->xh, fd->yl, fd->yh);
 #endif
 
     for ( yl = fd->yl; yl < fd->yh; yl++ )
         for ( xl = fd->xl; xl < fd->xh; xl++ )
-            tab[yl][xl] = v;
+            put_count(fd->fd, xl, yl, v);
 
     return;
 }
 //////////////////////////////////////
-static int gen_fractal_mb(fdata*);
+static int gen_fractal_mb(wdata*);
 //////////////////////////////////////
 static void
-splitBox(fdata* fd, int b)
+splitBox(wdata* fd, int b)
     /* splits box b into 4 smaller boxes and starts processing them */
 {
     int bl, bh;
@@ -287,12 +239,12 @@ splitBox(fdata* fd, int b)
     //	printf("\t\t[Worker-%d]->splitBox, box:%d\n", fd->wID, b);
 #endif
     /* first we save bl and bh on stack and we assign them new values */
-    pthread_mutex_lock(fd->mutt);
+    pthread_mutex_lock(&fd->mutt);
     bl = fd->bl;
     bh = fd->bh;
     fd->bl = (b * 4) + 1;
     fd->bh = (b * 4) + 5; // +1+4
-    pthread_mutex_unlock(fd->mutt);
+    pthread_mutex_unlock(&fd->mutt);
 
     /* informing manager about an opportunity to share a job */
     /* tutaj mozemy spotkac sie z tym, ze jeden watek wejdzie do
@@ -313,46 +265,54 @@ splitBox(fdata* fd, int b)
     gen_fractal_mb(fd);
 
     /* after completing smaller box we get back to counting another big one */
-    pthread_mutex_lock(fd->mutt);
+    pthread_mutex_lock(&fd->mutt);
     fd->bl = bl;
     fd->bh = bh;
-    pthread_mutex_unlock(fd->mutt);
+    pthread_mutex_unlock(&fd->mutt);
 
     return;	
 }
 //////////////////////////////////////
 static int
-processBox(fdata* fd, int b)
+processBox(wdata* d, int b)
     /* Processes box b */
 {
     complex<double> c0, c1, c2, c3;
-    int yl, yh, xl, xh, i, range;
+    int yl, yh, xl, xh, xo, yo, i, range;
     int p0, p1, p2, p3, p;
     double xmin, ymin, xdiff, ydiff;
 
 #ifdef DEBUG
-    //printf("\t[Worker-%d]->processBox\n", fd->wID);
+    //printf("\t[Worker-%d]->processBox\n", d->wID);
 #endif
     /* we need exact coordinates of the box we are about to check */
+    const fdata* fd = d->fd;
     cords c;
     addr(fd, b, &c);
 
     /* we are checking what pixels that would be and we are saving them in our raport */
-    addrPix(fd, &c);
+    addrPix(d, &c);
+
+    /* box lying far from the set is filled at once */
+    if ( fd->use_de && exterior_cell(fd, d->yl, d->yh, d->xl, d->xh, &p) ) {
+        fulfillBox(d, p);
+        return 0;
+    }
 
     /* finally we are checking if every value on the border is equal
      * if not we are splitting the box into 4 smaller ones
      */
-    xl = fd->xl, xh = fd->xh;
-    yl = fd->yl, yh = fd->yh;
+    xl = d->xl, xh = d->xh;
+    yl = d->yl, yh = d->yh;
+    xo = fd->xo, yo = fd->yo;
     xmin = fd->xmin, ymin = fd->ymin;
     xdiff = fd->xdiff, ydiff = fd->ydiff;
     range = xh - xl;
     for(i=0; i < range; i++ ) {
-        c0 = complex<double>(xmin+(xl+0.5)*xdiff, ymin+(yl+i+0.5)*ydiff);
-        c1 = complex<double>(xmin+(xl+i+0.5)*xdiff, ymin+(yh-0.5)*ydiff);
-        c2 = complex<double>(xmin+(xh-0.5)*xdiff, ymin+(yl+i+0.5)*ydiff);
-        c3 = complex<double>(xmin+(xl+i+0.5)*xdiff, ymin+(yl+0.5)*ydiff);
+        c0 = complex<double>(xmin+(xo+xl+0.5)*xdiff, ymin+(yo+yl+i+0.5)*ydiff);
+        c1 = complex<double>(xmin+(xo+xl+i+0.5)*xdiff, ymin+(yo+yh-0.5)*ydiff);
+        c2 = complex<double>(xmin+(xo+xh-0.5)*xdiff, ymin+(yo+yl+i+0.5)*ydiff);
+        c3 = complex<double>(xmin+(xo+xl+i+0.5)*xdiff, ymin+(yo+yl+0.5)*ydiff);
 
         p0 = fractal_point(c0, fd);
         p1 = fractal_point(c1, fd);
@@ -366,25 +326,25 @@ processBox(fdata* fd, int b)
         /* if values are different */
         if ( (p ^ p0) || (p ^ p1) || (p ^ p2) || (p ^ p3) ) {
             /* we have to check if box is big enought to consider splitting it, otherwise we count it normally */
-            if ( sizeBox(fd) < fd->sbs ) {
-                countBox(fd);
+            if ( sizeBox(d) < fd->sbs ) {
+                countBox(d);
                 return 0;
             }
-            splitBox(fd, b);
+            splitBox(d, b);
             return 0;
         }
     }
 #ifdef DEBUG
-    //printf("\t[Worker-%d]->processBox(before fulfillBox, xl=%d, xh=%d, yl=%d, yh=%d\n", fd->wID, fd->xl, fd->xh, fd->yl, fd->yh);
+    //printf("\t[Worker-%d]->processBox(before fulfillBox, xl=%d, xh=%d, yl=%d, yh=%d\n", d->wID, d->xl, d->xh, d->yl, d->yh);
 #endif
-    fulfillBox(fd, p);
+    fulfillBox(d, p);
 
     return 0;
 }
 
 //////////////////////////////////////
 static int
-gen_fractal_mb(fdata* d)
+gen_fractal_mb(wdata* d)
 {
     int bl;
 
@@ -392,7 +352,7 @@ gen_fractal_mb(fdata* d)
     printf("[Worker-%d]->gen_fractal_mb: %d %d\n", d->wID, d->bl, d->bh);
 #endif
 
-    pthread_mutex_lock(d->mutt);
+    pthread_mutex_lock(&d->mutt);
     while(1)
     {
         /* do we have anything to count? */
@@ -400,17 +360,18 @@ gen_fractal_mb(fdata* d)
 
         if ( bl < d->bh ) {
             d->status = 1;
-            pthread_mutex_unlock(d->mutt);
+            pthread_mutex_unlock(&d->mutt);
         } else {
             d->status = 0;
             break;
         }
 
-        /* There is at least one box to process */
-        processBox(d, bl);
+        /* There is at least one box to process; after a cancel the rest is only skipped */
+        if ( ! cancelled(d->fd) )
+            processBox(d, bl);
 
         /* after finishing the box we lock our mutex, if it's already closed it means manager has locked it */
-        pthread_mutex_lock(d->mutt);
+        pthread_mutex_lock(&d->mutt);
 
         ++bl;
         d->bl = bl;
@@ -419,7 +380,7 @@ gen_fractal_mb(fdata* d)
             break;
         }
     }
-    pthread_mutex_unlock(d->mutt);
+    pthread_mutex_unlock(&d->mutt);
 
     return 0;
 }
@@ -429,11 +390,26 @@ gen_fractal_mb(fdata* d)
 void*
 worker(void* d) //d jak dane ;]
 {
-    fdata* fd = (fdata*) d;
+    wdata* fd = (wdata*) d;
     int lstat; // local status
+    int y;
+
+    affinity_pin(fd->wID);
+    perf_thread_begin();
+
+    /*
+     * first touch: pages of our initial rows are placed on our NUMA node;
+     * the manager cannot hand them to anybody else in the meantime
+     */
+    if ( fd->fd->touch && ! fd->fd->use_mb ) {
+        pthread_mutex_lock(&fd->mutt);
+        for ( y = ROWS_LO(fd->rows); y < ROWS_HI(fd->rows); y++ )
+            memset(fd->fd->tab[y], 0, fd->fd->resolution);
+        pthread_mutex_unlock(&fd->mutt);
+    }
 
     while(1) {
-        pthread_mutex_lock(fd->mutt);
+        pthread_mutex_lock(&fd->mutt);
         lstat = fd->status; // bc of the weird statuses on exit I made a local copy
 
 #ifdef DEBUG
@@ -453,17 +429,17 @@ worker(void* d) //d jak dane ;]
          * somewhere else in a moment
          */
         if ( lstat == 1 ) {
-            pthread_mutex_unlock(fd->mutt);		
+            pthread_mutex_unlock(&fd->mutt);		
         } else if ( lstat == 0 ) {
-            pthread_mutex_unlock(fd->mutt);
+            pthread_mutex_unlock(&fd->mutt);
             get_job(fd);
             continue;
         } else if ( lstat == 2 ) {
-            pthread_mutex_unlock(fd->mutt);
+            pthread_mutex_unlock(&fd->mutt);
             break;
         } else {
             printf("\t[Worker-%d]->Unknown status value: %d. Finishing.\n", fd->wID, lstat);
-            pthread_mutex_unlock(fd->mutt);
+            pthread_mutex_unlock(&fd->mutt);
             break;
         }
 
@@ -474,9 +450,14 @@ worker(void* d) //d jak dane ;]
          * We do the work we were given; it can be interrupted
          * after finishing it we have our status set to 0
          */
-        if (fd->use_mb)
+        if (fd->fd->use_mb) {
             gen_fractal_mb(fd);
-        else
+            /*
+             * a manager waiting for a box to split wakes up: we will not split
+             * any more, so it may finish the thread it serves instead of timing out
+             */
+            pthread_cond_signal(&newBox);
+        } else
             gen_fractal(fd);
 
         get_job(fd);
@@ -484,6 +465,7 @@ worker(void* d) //d jak dane ;]
 #ifdef DEBUG
     printf("[Worker-%d]->RIP !!!\n", fd->wID);
 #endif
+    perf_thread_end("worker", fd->wID);
 
     return 0;
 }